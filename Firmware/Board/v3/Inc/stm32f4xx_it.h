@@ -67,6 +67,7 @@ void TIM8_TRG_COM_TIM14_IRQHandler(void);
 void TIM5_IRQHandler(void);
 void SPI3_IRQHandler(void);
 void UART4_IRQHandler(void);
+void DMA2_Stream1_IRQHandler(void);
 void OTG_FS_IRQHandler(void);
 
 #ifdef __cplusplus
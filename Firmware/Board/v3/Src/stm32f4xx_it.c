@@ -70,6 +70,7 @@ extern TIM_HandleTypeDef htim5;
 extern TIM_HandleTypeDef htim8;
 extern DMA_HandleTypeDef hdma_uart4_rx;
 extern DMA_HandleTypeDef hdma_uart4_tx;
+extern DMA_HandleTypeDef hdma_adc3;
 extern UART_HandleTypeDef huart4;
 
 extern TIM_HandleTypeDef htim14;
@@ -274,7 +275,9 @@ void ADC_IRQHandler(void)
 
   // The HAL's ADC handling mechanism adds many clock cycles of overhead
   // So we bypass it and handle the logic ourselves.
-  //@TODO add vbus measurement on adc1 here
+  // With enable_simultaneous_adc, ADC1 and ADC2 are read in the callback of
+  // ADC3 and their interrupts are disabled, and the Motor 1 samples of the
+  // regular groups are signalled by DMA2_Stream1_IRQHandler.
   ADC_IRQ_Dispatch(&hadc1, &vbus_sense_adc_cb);
   ADC_IRQ_Dispatch(&hadc2, &pwm_trig_adc_cb);
   ADC_IRQ_Dispatch(&hadc3, &pwm_trig_adc_cb);
@@ -407,6 +410,28 @@ void UART4_IRQHandler(void)
   /* USER CODE END UART4_IRQn 1 */
 }
 
+/**
+* @brief This function handles DMA2 stream1 global interrupt.
+*/
+void DMA2_Stream1_IRQHandler(void)
+{
+  /* USER CODE BEGIN DMA2_Stream1_IRQn 0 */
+
+  // ADC3 finished the transfer of the Motor 1 current samples.
+  // Bypass the HAL like for the ADC interrupt.
+  if (__HAL_DMA_GET_FLAG(&hdma_adc3, __HAL_DMA_GET_TC_FLAG_INDEX(&hdma_adc3))) {
+    __HAL_DMA_CLEAR_FLAG(&hdma_adc3, __HAL_DMA_GET_TC_FLAG_INDEX(&hdma_adc3));
+    pwm_trig_adc_cb(&hadc3, false);
+  }
+  return;
+
+  /* USER CODE END DMA2_Stream1_IRQn 0 */
+  HAL_DMA_IRQHandler(&hdma_adc3);
+  /* USER CODE BEGIN DMA2_Stream1_IRQn 1 */
+
+  /* USER CODE END DMA2_Stream1_IRQn 1 */
+}
+
 /**
 * @brief This function handles USB On The Go FS global interrupt.
 */
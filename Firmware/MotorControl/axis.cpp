@@ -12,20 +12,23 @@ Axis::Axis(const AxisHardwareConfig_t& hw_config,
            SensorlessEstimator& sensorless_estimator,
            Controller& controller,
            Motor& motor,
-           TrapezoidalTrajectory& trap)
+           TrapezoidalTrajectory& trap,
+           SCurveTrajectory& scurve)
     : hw_config_(hw_config),
       config_(config),
       encoder_(encoder),
       sensorless_estimator_(sensorless_estimator),
       controller_(controller),
       motor_(motor),
-      trap_(trap)
+      trap_(trap),
+      scurve_(scurve)
 {
     encoder_.axis_ = this;
     sensorless_estimator_.axis_ = this;
     controller_.axis_ = this;
     motor_.axis_ = this;
     trap_.axis_ = this;
+    scurve_.axis_ = this;
 
     decode_step_dir_pins();
     update_watchdog_settings();
@@ -76,6 +79,22 @@ void Axis::step_cb() {
     }
 };
 
+static void home_switch_cb_wrapper(void* ctx) {
+    reinterpret_cast<Axis*>(ctx)->home_switch_cb();
+}
+
+// Triggered on the rising edge of the home switch GPIO.
+// The encoder counter is latched right here in the interrupt, so the home
+// position doesn't depend on the control loop rate or the search speed.
+void Axis::home_switch_cb() {
+    if (!home_switch_latched_) {
+        home_switch_cnt_ = (uint16_t)encoder_.hw_config_.timer->Instance->CNT;
+        home_switch_latched_ = true;
+    }
+    GPIO_unsubscribe(get_gpio_port_by_pin(config_.homing.switch_gpio_pin),
+            get_gpio_pin_by_pin(config_.homing.switch_gpio_pin));
+}
+
 void Axis::load_default_step_dir_pin_config(
         const AxisHardwareConfig_t& hw_config, Config_t* config) {
     config->step_gpio_pin = hw_config.step_gpio_pin;
@@ -157,6 +176,42 @@ bool Axis::do_updates() {
     return check_for_errors();
 }
 
+// @brief Latches an event. Only called from this axis' thread.
+void Axis::raise_event(Event_t event) {
+    uint32_t prim = cpu_enter_critical();
+    events_ |= event;
+    ++event_count_;
+    cpu_exit_critical(prim);
+}
+
+// @brief Clears the specified events.
+// @returns the events out of mask that were set before clearing
+uint32_t Axis::clear_events(uint32_t mask) {
+    uint32_t prim = cpu_enter_critical();
+    uint32_t events = events_ & mask;
+    events_ &= static_cast<Event_t>(~mask);
+    cpu_exit_critical(prim);
+    return events;
+}
+
+// @brief Blocks the calling protocol channel until one of the specified
+// events is latched, then clears and returns them.
+// Fibre has no way for the device to push a message to the host, so this
+// long-poll is how a host waits for an event without polling over the bus.
+// Other requests on the same channel are held up meanwhile, so the timeout
+// is capped to a few control periods of a typical host; hosts that wait
+// longer call this in a loop.
+// @returns the events out of mask that occurred, 0 on timeout
+uint32_t Axis::wait_for_events(uint32_t mask, uint32_t timeout_ms) {
+    static const uint32_t max_timeout_ms = 20;
+    if (timeout_ms > max_timeout_ms)
+        timeout_ms = max_timeout_ms;
+    uint32_t start = osKernelSysTick();
+    while (!(events_ & mask) && (osKernelSysTick() - start) < timeout_ms)
+        osDelay(1);
+    return clear_events(mask);
+}
+
 // @brief Feed the watchdog to prevent watchdog timeouts.
 void Axis::watchdog_feed() {
     watchdog_current_value_ = watchdog_reset_value_;
@@ -240,6 +295,67 @@ bool Axis::run_lockin_spin() {
     return check_for_errors();
 }
 
+// @brief Moves at homing.speed until the home switch edge latches the encoder
+// count, backs off the switch with a trapezoidal move, and then shifts the
+// linear count such that the switch edge is at homing.home_position.
+bool Axis::run_homing() {
+    GPIO_TypeDef* switch_port = get_gpio_port_by_pin(config_.homing.switch_gpio_pin);
+    uint16_t switch_pin = get_gpio_pin_by_pin(config_.homing.switch_gpio_pin);
+
+    is_homed_ = false;
+    home_switch_latched_ = false;
+    if (!GPIO_subscribe(switch_port, switch_pin, GPIO_PULLDOWN, home_switch_cb_wrapper, this))
+        return error_ |= ERROR_HOMING_SWITCH_NOT_FOUND, false;
+
+    // The soft limits are in the frame of the home position, which is not known yet
+    controller_.soft_limits_suspended_ = true;
+
+    float start_pos = encoder_.pos_estimate_;
+    controller_.pos_setpoint_ = start_pos;
+    controller_.set_vel_setpoint(config_.homing.speed, 0.0f);
+
+    bool backing_off = false;
+    int32_t switch_count = 0;
+    run_control_loop([&](){
+        if (!backing_off) {
+            if (home_switch_latched_) {
+                // Extend the 16 bit latched count the same way Encoder::update does
+                int16_t delta = (int16_t)home_switch_cnt_ - (int16_t)encoder_.shadow_count_;
+                switch_count = encoder_.shadow_count_ + (int32_t)delta;
+                float backoff_dir = (config_.homing.speed > 0.0f) ? -1.0f : 1.0f;
+                controller_.move_to_pos((float)switch_count + backoff_dir * config_.homing.backoff_distance);
+                backing_off = true;
+            } else if (config_.homing.max_distance > 0.0f
+                    && fabsf(encoder_.pos_estimate_ - start_pos) > config_.homing.max_distance) {
+                return error_ |= ERROR_HOMING_SWITCH_NOT_FOUND, false;
+            }
+        }
+
+        float current_setpoint;
+        if (!controller_.update(encoder_.pos_estimate_, encoder_.vel_estimate_, &current_setpoint))
+            return error_ |= ERROR_CONTROLLER_FAILED, false;
+        float phase_vel = 2*M_PI * encoder_.vel_estimate_ / (float)encoder_.config_.cpr * motor_.config_.pole_pairs;
+        if (!motor_.update(current_setpoint, encoder_.phase_, phase_vel))
+            return false;
+
+        if (backing_off && controller_.config_.control_mode != Controller::CTRL_MODE_TRAJECTORY_CONTROL) {
+            // Back off done: make the switch edge the home position, and
+            // shift the setpoint along so that the axis doesn't move
+            int32_t shift = (int32_t)lroundf(config_.homing.home_position) - switch_count;
+            encoder_.set_linear_count(encoder_.shadow_count_ + shift);
+            controller_.pos_setpoint_ += (float)shift;
+            controller_.soft_limits_suspended_ = false;
+            is_homed_ = true;
+            return false;
+        }
+        return true;
+    });
+    GPIO_unsubscribe(switch_port, switch_pin);
+    controller_.soft_limits_suspended_ = false;
+
+    return is_homed_ && check_for_errors();
+}
+
 // Note run_sensorless_control_loop and run_closed_loop_control_loop are very similar and differ only in where we get the estimate from.
 bool Axis::run_sensorless_control_loop() {
     run_control_loop([this](){
@@ -313,6 +429,8 @@ void Axis::run_state_machine_loop() {
                     task_chain_[pos++] = AXIS_STATE_ENCODER_INDEX_SEARCH;
                 if (config_.startup_encoder_offset_calibration)
                     task_chain_[pos++] = AXIS_STATE_ENCODER_OFFSET_CALIBRATION;
+                if (config_.startup_homing)
+                    task_chain_[pos++] = AXIS_STATE_HOMING;
                 if (config_.startup_closed_loop_control)
                     task_chain_[pos++] = AXIS_STATE_CLOSED_LOOP_CONTROL;
                 else if (config_.startup_sensorless_control)
@@ -392,6 +510,22 @@ void Axis::run_state_machine_loop() {
                 status = run_closed_loop_control_loop();
             } break;
 
+            case AXIS_STATE_HOMING: {
+                if (!motor_.is_calibrated_ || motor_.config_.direction==0)
+                    goto invalid_state_label;
+                if (!encoder_.is_ready_ || encoder_.config_.mode != Encoder::MODE_INCREMENTAL)
+                    goto invalid_state_label;
+                if (config_.homing.switch_gpio_pin == 0 || config_.homing.speed == 0.0f)
+                    goto invalid_state_label;
+                status = run_homing();
+            } break;
+
+            case AXIS_STATE_FLUX_LINKAGE_CALIBRATION: {
+                if (!motor_.is_calibrated_ || motor_.config_.motor_type != Motor::MOTOR_TYPE_HIGH_CURRENT)
+                    goto invalid_state_label;
+                status = motor_.measure_flux_linkage();
+            } break;
+
             case AXIS_STATE_IDLE: {
                 run_idle_loop();
                 status = motor_.arm(); // done with idling - try to arm the motor
@@ -405,6 +539,8 @@ void Axis::run_state_machine_loop() {
         }
 
         // If the state failed, go to idle, else advance task chain
+        if (!status && error_ != ERROR_NONE)
+            raise_event(EVENT_ERROR);
         if (!status)
             current_state_ = AXIS_STATE_IDLE;
         else
@@ -21,6 +21,7 @@ public:
         ERROR_CONTROLLER_FAILED = 0x200,
         ERROR_POS_CTRL_DURING_SENSORLESS = 0x400,
         ERROR_WATCHDOG_TIMER_EXPIRED = 0x800,
+        ERROR_HOMING_SWITCH_NOT_FOUND = 0x1000,
     };
 
     enum State_t {
@@ -35,6 +36,19 @@ public:
         AXIS_STATE_CLOSED_LOOP_CONTROL = 8,  //<! run closed loop control
         AXIS_STATE_LOCKIN_SPIN = 9,       //<! run lockin spin
         AXIS_STATE_ENCODER_DIR_FIND = 10,
+        AXIS_STATE_HOMING = 11,             //<! run towards the home switch and set the position there
+        AXIS_STATE_FLUX_LINKAGE_CALIBRATION = 12, //<! spin the motor open loop to measure its flux linkage
+    };
+
+    // Events are latched until the host clears them, so that a host can wait
+    // for them instead of polling the state they are derived from.
+    enum Event_t {
+        EVENT_NONE = 0x00,
+        EVENT_IN_POSITION = 0x01,     //<! position error entered controller.config.in_position_window
+        EVENT_TRAJECTORY_DONE = 0x02, //<! trajectory reached its goal point
+        EVENT_ERROR = 0x04,           //<! the axis stopped due to an error
+        EVENT_PVT_UNDERRUN = 0x08,    //<! the PVT queue ran empty
+        EVENT_PVT_LOW_WATERMARK = 0x10, //<! the PVT queue drained to controller.pvt.config.low_watermark
     };
 
     struct LockinConfig_t {
@@ -49,11 +63,20 @@ public:
         bool finish_on_enc_idx = false;
     };
 
+    struct HomingConfig_t {
+        uint16_t switch_gpio_pin = 0;    // GPIO that rises when the home switch is reached, 0 for none
+        float speed = -2000.0f;          // [counts/s] search velocity, the sign selects the direction
+        float max_distance = 0.0f;       // [counts] give up after this distance, 0.0f for no limit
+        float backoff_distance = 1000.0f; // [counts] move back off the switch by this much
+        float home_position = 0.0f;      // [counts] position assigned to the switch edge
+    };
+
     struct Config_t {
         bool startup_motor_calibration = false;   //<! run motor calibration at startup, skip otherwise
         bool startup_encoder_index_search = false; //<! run encoder index search after startup, skip otherwise
                                                 // this only has an effect if encoder.config.use_index is also true
         bool startup_encoder_offset_calibration = false; //<! run encoder offset calibration after startup, skip otherwise
+        bool startup_homing = false; //<! run homing after calibration/startup
         bool startup_closed_loop_control = false; //<! enable closed loop control after calibration/startup
         bool startup_sensorless_control = false; //<! enable sensorless control after calibration/startup
         bool enable_step_dir = false; //<! enable step/dir input after calibration
@@ -67,6 +90,7 @@ public:
         uint16_t dir_gpio_pin = 0;
 
         LockinConfig_t lockin;
+        HomingConfig_t homing;
     };
 
     enum thread_signals {
@@ -86,7 +110,8 @@ public:
             SensorlessEstimator& sensorless_estimator,
             Controller& controller,
             Motor& motor,
-            TrapezoidalTrajectory& trap);
+            TrapezoidalTrajectory& trap,
+            SCurveTrajectory& scurve);
 
     void setup();
     void start_thread();
@@ -94,6 +119,7 @@ public:
     bool wait_for_current_meas();
 
     void step_cb();
+    void home_switch_cb();
     void set_step_dir_active(bool enable);
     void decode_step_dir_pins();
     void update_watchdog_settings();
@@ -106,6 +132,10 @@ public:
     bool do_checks();
     bool do_updates();
 
+    void raise_event(Event_t event);
+    uint32_t clear_events(uint32_t mask);
+    uint32_t wait_for_events(uint32_t mask, uint32_t timeout_ms);
+
     void watchdog_feed();
     bool watchdog_check();
 
@@ -177,6 +207,7 @@ public:
     }
 
     bool run_lockin_spin();
+    bool run_homing();
     bool run_sensorless_control_loop();
     bool run_closed_loop_control_loop();
     bool run_idle_loop();
@@ -191,6 +222,7 @@ public:
     Controller& controller_;
     Motor& motor_;
     TrapezoidalTrajectory& trap_;
+    SCurveTrajectory& scurve_;
 
     osThreadId thread_id_;
     volatile bool thread_id_valid_ = false;
@@ -211,6 +243,15 @@ public:
     uint32_t loop_counter_ = 0;
     LockinState_t lockin_state_ = LOCKIN_STATE_INACTIVE;
 
+    // events
+    Event_t events_ = EVENT_NONE;
+    volatile uint32_t event_count_ = 0; // incremented on every raised event
+
+    // homing
+    volatile bool home_switch_latched_ = false;
+    volatile uint16_t home_switch_cnt_ = 0; // raw encoder timer count at the switch edge
+    bool is_homed_ = false;
+
     // watchdog
     uint32_t watchdog_reset_value_ = 0; //computed from config_.watchdog_timeout in update_watchdog_settings()
     uint32_t watchdog_current_value_= 0;
@@ -224,10 +265,14 @@ public:
             make_protocol_property("requested_state", &requested_state_),
             make_protocol_ro_property("loop_counter", &loop_counter_),
             make_protocol_ro_property("lockin_state", &lockin_state_),
+            make_protocol_ro_property("is_homed", &is_homed_),
+            make_protocol_ro_property("events", &events_),
+            make_protocol_ro_property("event_count", const_cast<uint32_t*>(&event_count_)),
             make_protocol_object("config",
                 make_protocol_property("startup_motor_calibration", &config_.startup_motor_calibration),
                 make_protocol_property("startup_encoder_index_search", &config_.startup_encoder_index_search),
                 make_protocol_property("startup_encoder_offset_calibration", &config_.startup_encoder_offset_calibration),
+                make_protocol_property("startup_homing", &config_.startup_homing),
                 make_protocol_property("startup_closed_loop_control", &config_.startup_closed_loop_control),
                 make_protocol_property("startup_sensorless_control", &config_.startup_sensorless_control),
                 make_protocol_property("enable_step_dir", &config_.enable_step_dir),
@@ -248,6 +293,13 @@ public:
                     make_protocol_property("finish_on_vel", &config_.lockin.finish_on_vel),
                     make_protocol_property("finish_on_distance", &config_.lockin.finish_on_distance),
                     make_protocol_property("finish_on_enc_idx", &config_.lockin.finish_on_enc_idx)
+                ),
+                make_protocol_object("homing",
+                    make_protocol_property("switch_gpio_pin", &config_.homing.switch_gpio_pin),
+                    make_protocol_property("speed", &config_.homing.speed),
+                    make_protocol_property("max_distance", &config_.homing.max_distance),
+                    make_protocol_property("backoff_distance", &config_.homing.backoff_distance),
+                    make_protocol_property("home_position", &config_.homing.home_position)
                 )
             ),
             make_protocol_object("motor", motor_.make_protocol_definitions()),
@@ -255,12 +307,15 @@ public:
             make_protocol_object("encoder", encoder_.make_protocol_definitions()),
             make_protocol_object("sensorless_estimator", sensorless_estimator_.make_protocol_definitions()),
             make_protocol_object("trap_traj", trap_.make_protocol_definitions()),
-            make_protocol_function("watchdog_feed", *this, &Axis::watchdog_feed)
+            make_protocol_function("watchdog_feed", *this, &Axis::watchdog_feed),
+            make_protocol_function("clear_events", *this, &Axis::clear_events, "mask"),
+            make_protocol_function("wait_for_events", *this, &Axis::wait_for_events, "mask", "timeout_ms")
         );
     }
 };
 
 
 DEFINE_ENUM_FLAG_OPERATORS(Axis::Error_t)
+DEFINE_ENUM_FLAG_OPERATORS(Axis::Event_t)
 
 #endif /* __AXIS_HPP */
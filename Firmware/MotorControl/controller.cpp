@@ -1,9 +1,16 @@
 
+#include <algorithm>
+
 #include "odrive_main.h"
 
 
 Controller::Controller(Config_t& config) :
-    config_(config)
+    config_(config),
+    input_shaper_(config.input_shaper),
+    repetitive_control_(config.repetitive_control),
+    inertia_estimator_(config.inertia_estimator),
+    pvt_(config.pvt),
+    motion_table_(config.motion_table)
 {}
 
 void Controller::reset() {
@@ -11,6 +18,17 @@ void Controller::reset() {
     vel_setpoint_ = 0.0f;
     vel_integrator_current_ = 0.0f;
     current_setpoint_ = 0.0f;
+    dob_state_ = 0.0f;
+    load_torque_estimate_ = 0.0f;
+    // Changes to the input shaper config take effect here, i.e. on the next arming
+    if (!input_shaper_.setup())
+        set_error(ERROR_INVALID_INPUT_SHAPER);
+    repetitive_control_.reset();
+    // Queued PVT points are kept, so a host can fill the queue before arming
+    pvt_active_ = false;
+    // Gearing re-latches the master and slave reference positions on the next update
+    gearing_active_ = false;
+    motion_table_active_ = false;
 }
 
 void Controller::set_error(Error_t error) {
@@ -49,13 +67,29 @@ void Controller::set_current_setpoint(float current_setpoint) {
 #endif
 }
 
-void Controller::move_to_pos(float goal_point) {
-    axis_->trap_.planTrapezoidal(goal_point, pos_setpoint_, vel_setpoint_,
-                                 axis_->trap_.config_.vel_limit,
-                                 axis_->trap_.config_.accel_limit,
-                                 axis_->trap_.config_.decel_limit);
+// @brief Plans a trajectory from the current setpoint without starting it.
+// Uses the S-curve planner if jerk_limit is non-zero.
+void Controller::plan_trajectory(float goal_point, float vel_limit, float accel_limit,
+                                 float decel_limit, float jerk_limit) {
+    traj_is_scurve_ = jerk_limit > 0.0f
+            && axis_->scurve_.planSCurve(goal_point, pos_setpoint_, vel_setpoint_,
+                                         vel_limit, accel_limit, decel_limit, jerk_limit);
+    if (!traj_is_scurve_) {
+        axis_->trap_.planTrapezoidal(goal_point, pos_setpoint_, vel_setpoint_,
+                                     vel_limit, accel_limit, decel_limit);
+    }
+}
+
+void Controller::start_trajectory() {
     traj_start_loop_count_ = axis_->loop_counter_;
     config_.control_mode = CTRL_MODE_TRAJECTORY_CONTROL;
+}
+
+void Controller::move_to_pos(float goal_point) {
+    const TrapezoidalTrajectory::Config_t& traj_config = axis_->trap_.config_;
+    plan_trajectory(goal_point, traj_config.vel_limit, traj_config.accel_limit,
+                    traj_config.decel_limit, traj_config.jerk_limit);
+    start_trajectory();
     goal_point_ = goal_point;
 }
 
@@ -67,6 +101,66 @@ void Controller::move_incremental(float displacement, bool from_goal_point = tru
     }
 }
 
+/*
+ * Coordinated move of all axes along a straight line.
+ * The move is planned for a path coordinate u that goes from 0 to 1, with
+ * limits such that no axis exceeds its own trap_traj limits:
+ *   V_u = min(vel_limit_i / |d_i|), and likewise for accel, decel and jerk.
+ * Each axis then plans its own move with the limits V_u * |d_i| etc., so all
+ * profiles are the same shape and finish together. Starting from standstill
+ * the axes stay on the straight line throughout the move.
+ * The S-curve planner is used only if all moving axes have a jerk limit.
+ * All axes are started in one critical section, i.e. in the same control cycle.
+ * @returns false if an axis is not in closed loop control
+ */
+bool move_coordinated(const float goal_points[AXIS_COUNT]) {
+    float vel_u = INFINITY, accel_u = INFINITY, decel_u = INFINITY, jerk_u = INFINITY;
+    float distances[AXIS_COUNT];
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        if (axes[i]->current_state_ != Axis::AXIS_STATE_CLOSED_LOOP_CONTROL)
+            return false;
+        const TrapezoidalTrajectory::Config_t& traj_config = axes[i]->trap_.config_;
+        distances[i] = fabsf(goal_points[i] - axes[i]->controller_.pos_setpoint_);
+        if (distances[i] > 0.0f) {
+            vel_u = std::min(vel_u, traj_config.vel_limit / distances[i]);
+            accel_u = std::min(accel_u, traj_config.accel_limit / distances[i]);
+            decel_u = std::min(decel_u, traj_config.decel_limit / distances[i]);
+            jerk_u = std::min(jerk_u, traj_config.jerk_limit / distances[i]);
+        }
+    }
+
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        Controller& controller = axes[i]->controller_;
+        float d = distances[i];
+        if (d > 0.0f) {
+            controller.plan_trajectory(goal_points[i], vel_u * d, accel_u * d, decel_u * d, jerk_u * d);
+        } else {
+            // Hold still, using the planner's own limits to stop if still moving
+            const TrapezoidalTrajectory::Config_t& traj_config = axes[i]->trap_.config_;
+            controller.plan_trajectory(goal_points[i], traj_config.vel_limit, traj_config.accel_limit,
+                                       traj_config.decel_limit, traj_config.jerk_limit);
+        }
+        controller.goal_point_ = goal_points[i];
+    }
+
+    uint32_t prim = cpu_enter_critical();
+    for (size_t i = 0; i < AXIS_COUNT; ++i)
+        axes[i]->controller_.start_trajectory();
+    cpu_exit_critical(prim);
+    return true;
+}
+
+void Controller::set_cam_point(int32_t index, float value) {
+    if (index >= 0 && index < (int32_t)kCamTableSize)
+        config_.cam_table[index] = value;
+}
+
+float Controller::get_cam_point(int32_t index) {
+    if (index >= 0 && index < (int32_t)kCamTableSize)
+        return config_.cam_table[index];
+    return 0.0f;
+}
+
 void Controller::start_anticogging_calibration() {
     // Ensure the cogging map was correctly allocated earlier and that the motor is capable of calibrating
     if (anticogging_.cogging_map != NULL && axis_->error_ == Axis::ERROR_NONE) {
@@ -102,6 +196,313 @@ bool Controller::anticogging_calibration(float pos_estimate, float vel_estimate)
     return false;
 }
 
+void Controller::start_friction_identification() {
+    if (axis_->error_ == Axis::ERROR_NONE && config_.friction_id_steps >= 2
+            && config_.friction_id_max_vel > 0.0f && config_.friction_id_step_time > 0.0f) {
+        friction_id_ = FrictionId_t();
+        friction_id_.running = true;
+        set_vel_setpoint(friction_id_vel(0), 0.0f);
+    }
+}
+
+// @brief Velocity setpoint of a step of the friction identification sweep.
+// The speeds are spread evenly up to friction_id_max_vel, except that the
+// slowest speed of each direction is at most half of stribeck_vel, where
+// the Stribeck term is large enough to be fitted.
+float Controller::friction_id_vel(int32_t step) {
+    const int32_t N = config_.friction_id_steps;
+    float sign = (step < N) ? 1.0f : -1.0f;
+    float vel = config_.friction_id_max_vel * (float)(step % N + 1) / (float)N;
+    if (step % N == 0 && config_.stribeck_vel > 0.0f)
+        vel = std::min(vel, 0.5f * config_.stribeck_vel);
+    return sign * vel;
+}
+
+/*
+ * Friction identification sweeps the velocity setpoint through
+ * friction_id_steps speeds in each direction. At each speed it waits for the
+ * velocity loop to settle, then averages the velocity and the current the
+ * loop needs to hold it. The friction feed-forward is disabled meanwhile,
+ * so the average current is the friction at that speed.
+ *
+ * Coulomb and viscous friction are fitted by least squares to all but the
+ * slowest speed of each direction. The Stribeck term (for the configured
+ * stribeck_vel) is then fitted to whatever current the model leaves
+ * unexplained at the slowest speeds. A direction whose slowest speed didn't
+ * stay well below stribeck_vel is left out, since dividing by the tiny
+ * Stribeck factor there would mostly amplify noise.
+ */
+void Controller::friction_identification(float vel_estimate, float current) {
+    if (!friction_id_.running)
+        return;
+    if (config_.control_mode != CTRL_MODE_VELOCITY_CONTROL) {
+        friction_id_.running = false; // aborted by a new command
+        return;
+    }
+
+    const int32_t N = config_.friction_id_steps;
+    const uint32_t step_ticks = (uint32_t)(config_.friction_id_step_time * current_meas_hz);
+    if (++friction_id_.ticks > step_ticks / 2) {
+        friction_id_.vel_sum += vel_estimate;
+        friction_id_.current_sum += current;
+        ++friction_id_.samples;
+    }
+    if (friction_id_.ticks < step_ticks)
+        return;
+
+    // Speed done: add it to the fit
+    if (friction_id_.samples > 0) {
+        float v = friction_id_.vel_sum / (float)friction_id_.samples;
+        float i = friction_id_.current_sum / (float)friction_id_.samples;
+        float sign = (friction_id_.step < N) ? 1.0f : -1.0f;
+        if (friction_id_.step % N == 0) {
+            friction_id_.low_speed_vel[friction_id_.step / N] = v;
+            friction_id_.low_speed_current[friction_id_.step / N] = i;
+        } else {
+            friction_id_.s_ss += 1.0f;
+            friction_id_.s_sv += sign * v;
+            friction_id_.s_vv += v * v;
+            friction_id_.s_si += sign * i;
+            friction_id_.s_vi += v * i;
+        }
+    }
+    friction_id_.ticks = 0;
+    friction_id_.vel_sum = 0.0f;
+    friction_id_.current_sum = 0.0f;
+    friction_id_.samples = 0;
+
+    if (++friction_id_.step < 2 * N) {
+        set_vel_setpoint(friction_id_vel(friction_id_.step), 0.0f);
+        return;
+    }
+
+    // Sweep done: solve the 2x2 normal equations
+    set_vel_setpoint(0.0f, 0.0f);
+    friction_id_.running = false;
+    float det = friction_id_.s_ss * friction_id_.s_vv - SQ(friction_id_.s_sv);
+    if (fabsf(det) < 1e-6f)
+        return;
+    float Fc = (friction_id_.s_vv * friction_id_.s_si - friction_id_.s_sv * friction_id_.s_vi) / det;
+    float Fv = (friction_id_.s_ss * friction_id_.s_vi - friction_id_.s_sv * friction_id_.s_si) / det;
+    config_.friction_coulomb = std::max(Fc, 0.0f);
+    config_.friction_viscous = std::max(Fv, 0.0f);
+
+    float Fs = 0.0f;
+    size_t num_fitted = 0;
+    if (config_.stribeck_vel > 0.0f) {
+        for (size_t dir = 0; dir < 2; ++dir) {
+            float v = friction_id_.low_speed_vel[dir];
+            float stribeck_factor = expf(-SQ(v / config_.stribeck_vel));
+            if (stribeck_factor < 0.1f)
+                continue;
+            float residual = fabsf(friction_id_.low_speed_current[dir])
+                    - (config_.friction_coulomb + config_.friction_viscous * fabsf(v));
+            Fs += residual / stribeck_factor;
+            ++num_fitted;
+        }
+    }
+    if (num_fitted > 0)
+        Fs /= (float)num_fitted;
+    config_.friction_stribeck = std::max(Fs, 0.0f);
+}
+
+// @brief Friction current for a given velocity:
+//   (coulomb + stribeck * exp(-(v/stribeck_vel)^2)) * sign(v) + viscous * v
+// The sign function is smoothed over friction_smoothing_vel, so that the
+// feed-forward doesn't chatter around standstill.
+float Controller::friction_current(float vel) {
+    float smooth_sign = vel / sqrtf(SQ(vel) + SQ(config_.friction_smoothing_vel));
+    float breakaway = config_.friction_coulomb;
+    if (config_.stribeck_vel > 0.0f)
+        breakaway += config_.friction_stribeck * expf(-SQ(vel / config_.stribeck_vel));
+    return breakaway * smooth_sign + config_.friction_viscous * vel;
+}
+
+// @brief Feeds the inertia estimator and, once it has seen enough excitation,
+// writes the clamped estimate to the trajectory feed-forward and rescales the
+// velocity loop gains to keep their bandwidth constant.
+void Controller::update_inertia_estimate(float vel_estimate) {
+    float Iq = axis_->motor_.current_control_.Iq_measured * (float)axis_->motor_.config_.direction;
+    if (!inertia_estimator_.update(vel_estimate, Iq, axis_->trap_.config_.accel_limit, config_.vel_limit))
+        return;
+    if (inertia_estimator_.num_updates_ < InertiaEstimator::kMinUpdatesToApply)
+        return;
+
+    const InertiaEstimator::Config_t& est_config = inertia_estimator_.config_;
+    float A_per_css = std::max(est_config.A_per_css_min,
+                               std::min(inertia_estimator_.A_per_css_, est_config.A_per_css_max));
+    if (est_config.update_A_per_css) {
+        axis_->trap_.config_.A_per_css = A_per_css;
+    }
+    if (est_config.update_vel_gain && config_.vel_gain > 0.0f) {
+        float vel_gain = std::max(est_config.vel_gain_min,
+                                  std::min(A_per_css * est_config.vel_loop_bandwidth, est_config.vel_gain_max));
+        config_.vel_integrator_gain *= vel_gain / config_.vel_gain; // keep the integrator zero in place
+        config_.vel_gain = vel_gain;
+    }
+}
+
+// @brief Takes the setpoints from the PVT queue, starting from the current
+// setpoints when the mode is entered, and raises the queue events.
+void Controller::update_pvt() {
+    if (!pvt_active_) {
+        pvt_.start(pos_setpoint_, vel_setpoint_);
+        pvt_active_ = true;
+    }
+
+    bool was_underrun = pvt_.underrun_;
+    uint32_t count_before = pvt_.get_count();
+    PvtFifo::Step_t step;
+    bool ok = pvt_.update(&step);
+    uint32_t count_after = pvt_.get_count();
+
+    pos_setpoint_ = step.pos;
+    vel_setpoint_ = step.vel;
+    current_setpoint_ = step.acc * axis_->trap_.config_.A_per_css;
+
+    if (!ok && !was_underrun)
+        axis_->raise_event(Axis::EVENT_PVT_UNDERRUN);
+    if (count_before > pvt_.config_.low_watermark && count_after <= pvt_.config_.low_watermark)
+        axis_->raise_event(Axis::EVENT_PVT_LOW_WATERMARK);
+}
+
+// @brief Plays back the motion table from the current position setpoint.
+// @returns false if the table is empty
+bool Controller::start_motion_table() {
+    if (motion_table_.length_ == 0)
+        return false;
+    motion_table_active_ = false;
+    config_.control_mode = CTRL_MODE_MOTION_TABLE;
+    return true;
+}
+
+// @brief Takes the setpoints from the motion table. Playback starts when the
+// mode is entered; at the end of the table the axis drops into position
+// control like at the end of a trajectory.
+void Controller::update_motion_table() {
+    if (!motion_table_active_) {
+        motion_table_active_ = true;
+        if (!motion_table_.start(pos_setpoint_)) {
+            config_.control_mode = CTRL_MODE_POSITION_CONTROL;
+            vel_setpoint_ = 0.0f;
+            current_setpoint_ = 0.0f;
+            return;
+        }
+    }
+
+    MotionTable::Point_t step;
+    bool playing = motion_table_.update(&step);
+    pos_setpoint_ = step.pos;
+    vel_setpoint_ = step.vel;
+    current_setpoint_ = step.current;
+    if (!playing) {
+        config_.control_mode = CTRL_MODE_POSITION_CONTROL;
+        axis_->raise_event(Axis::EVENT_TRAJECTORY_DONE);
+    }
+}
+
+/*
+ * Electronic gearing and camming: the position setpoint follows the encoder
+ * of the master axis as
+ *   pos_setpoint = slave_ref + gear_ratio * x + cam(x),  x = master - master_ref
+ * where the references are captured when the mode is entered.
+ *
+ * The master position is taken from the raw counter sample captured in
+ * tim_update_cb, so it is coherent with this control tick and doesn't
+ * depend on whether the master's thread already ran its estimator update.
+ * The master can be the other axis, or an unused axis acting as an
+ * external encoder input.
+ */
+bool Controller::update_gearing() {
+    if (config_.gearing_master_axis < 0 || config_.gearing_master_axis >= (int32_t)AXIS_COUNT
+            || axes[config_.gearing_master_axis] == axis_) {
+        set_error(ERROR_INVALID_GEARING_MASTER);
+        return false;
+    }
+    Encoder& master = axes[config_.gearing_master_axis]->encoder_;
+
+    if (master.config_.mode == Encoder::MODE_INCREMENTAL) {
+        if (!gearing_active_) {
+            gearing_master_sample_ = master.tim_cnt_sample_;
+            gearing_master_count_ = master.shadow_count_;
+        }
+        int16_t delta = master.tim_cnt_sample_ - gearing_master_sample_;
+        gearing_master_sample_ = master.tim_cnt_sample_;
+        gearing_master_count_ += (int32_t)delta; // sign extend
+    } else {
+        gearing_master_count_ = master.shadow_count_;
+    }
+
+    if (!gearing_active_) {
+        gearing_master_ref_ = gearing_master_count_;
+        gearing_slave_ref_ = pos_setpoint_;
+        gearing_active_ = true;
+    }
+
+    float x = (float)(gearing_master_count_ - gearing_master_ref_);
+    float pos = gearing_slave_ref_ + config_.gear_ratio * x;
+    float slope = config_.gear_ratio;
+
+    if (config_.enable_cam && config_.cam_period > 0.0f) {
+        float idx_f = fmodf_pos(x, config_.cam_period) * ((float)kCamTableSize / config_.cam_period);
+        size_t idx = (size_t)idx_f;
+        if (idx >= kCamTableSize) idx = kCamTableSize - 1;
+        size_t idx_next = (idx + 1) % kCamTableSize;
+        float frac = idx_f - (float)idx;
+        float delta_cam = config_.cam_table[idx_next] - config_.cam_table[idx];
+        pos += config_.cam_table[idx] + frac * delta_cam;
+        slope += delta_cam * ((float)kCamTableSize / config_.cam_period);
+    }
+
+    pos_setpoint_ = pos;
+    vel_setpoint_ = slope * master.vel_estimate_;
+    current_setpoint_ = 0.0f;
+    return true;
+}
+
+/*
+ * Reduced order observer for the load torque, based on the rigid body model
+ *   inertia * d(omega)/dt = torque_constant * Iq - load_torque
+ * The state z = load_torque_estimate + L * inertia * omega avoids differentiating
+ * the velocity estimate, so the estimate is a first order low-pass (bandwidth L)
+ * of the true load torque.
+ *
+ * While the observer is disabled the state tracks the velocity, so that enabling
+ * it does not produce a transient.
+ *
+ * Without a positive inertia the estimate is just the filtered motor torque,
+ * which would be positive feedback when fed forward, so the observer then
+ * refuses to run.
+ */
+bool Controller::update_disturbance_observer(float vel_estimate) {
+    // The sensorless estimator reports electrical rad/s, the encoder counts/s
+    float omega; // [rad/s] mechanical
+    if (axis_->current_state_ == Axis::AXIS_STATE_SENSORLESS_CONTROL)
+        omega = vel_estimate / (float)axis_->motor_.config_.pole_pairs;
+    else
+        omega = vel_estimate * (2.0f * M_PI / (float)axis_->encoder_.config_.cpr);
+    float L = config_.dob_bandwidth;
+    float momentum_term = L * config_.inertia * omega;
+
+    if (!config_.enable_disturbance_observer) {
+        dob_state_ = momentum_term;
+        load_torque_estimate_ = 0.0f;
+        return true;
+    }
+
+    if (!(config_.inertia > 0.0f && axis_->motor_.config_.torque_constant > 0.0f)) {
+        set_error(ERROR_INVALID_LOAD_MODEL);
+        return false;
+    }
+
+    // Iq_measured is in the motor frame, the controller works in the encoder frame
+    float Iq = axis_->motor_.current_control_.Iq_measured * (float)axis_->motor_.config_.direction;
+    float motor_torque = axis_->motor_.config_.torque_constant * Iq;
+    dob_state_ += (current_meas_period * L) * (motor_torque + momentum_term - dob_state_);
+    load_torque_estimate_ = dob_state_ - momentum_term;
+    return true;
+}
+
 bool Controller::update(float pos_estimate, float vel_estimate, float* current_setpoint_output) {
     // Only runs if anticogging_.calib_anticogging is true; non-blocking
     anticogging_calibration(pos_estimate, vel_estimate);
@@ -112,14 +513,16 @@ bool Controller::update(float pos_estimate, float vel_estimate, float* current_s
         // Note: uint32_t loop count delta is OK across overflow
         // Beware of negative deltas, as they will not be well behaved due to uint!
         float t = (axis_->loop_counter_ - traj_start_loop_count_) * current_meas_period;
-        if (t > axis_->trap_.Tf_) {
+        float Tf = traj_is_scurve_ ? axis_->scurve_.Tf_ : axis_->trap_.Tf_;
+        if (t > Tf) {
             // Drop into position control mode when done to avoid problems on loop counter delta overflow
             config_.control_mode = CTRL_MODE_POSITION_CONTROL;
             // pos_setpoint already set by trajectory
             vel_setpoint_ = 0.0f;
             current_setpoint_ = 0.0f;
+            axis_->raise_event(Axis::EVENT_TRAJECTORY_DONE);
         } else {
-            TrapezoidalTrajectory::Step_t traj_step = axis_->trap_.eval(t);
+            TrapezoidalTrajectory::Step_t traj_step = traj_is_scurve_ ? axis_->scurve_.eval(t) : axis_->trap_.eval(t);
             pos_setpoint_ = traj_step.Y;
             vel_setpoint_ = traj_step.Yd;
             current_setpoint_ = traj_step.Ydd * axis_->trap_.config_.A_per_css;
@@ -127,6 +530,31 @@ bool Controller::update(float pos_estimate, float vel_estimate, float* current_s
         anticogging_pos = pos_setpoint_; // FF the position setpoint instead of the pos_estimate
     }
 
+    // Streamed position/velocity/time points
+    if (config_.control_mode == CTRL_MODE_PVT) {
+        update_pvt();
+        anticogging_pos = pos_setpoint_;
+    } else {
+        pvt_active_ = false;
+    }
+
+    // Playback of a precomputed motion table
+    if (config_.control_mode == CTRL_MODE_MOTION_TABLE) {
+        update_motion_table();
+        anticogging_pos = pos_setpoint_;
+    } else {
+        motion_table_active_ = false;
+        motion_table_.playing_ = false;
+    }
+
+    // Electronic gearing / camming
+    if (config_.control_mode == CTRL_MODE_GEARING) {
+        if (!update_gearing())
+            return false;
+    } else {
+        gearing_active_ = false;
+    }
+
     // Ramp rate limited velocity setpoint
     if (config_.control_mode == CTRL_MODE_VELOCITY_CONTROL && vel_ramp_enable_) {
         float max_step_size = current_meas_period * config_.vel_ramp_rate;
@@ -140,11 +568,29 @@ bool Controller::update(float pos_estimate, float vel_estimate, float* current_s
         vel_setpoint_ += step;
     }
 
+    // Soft position limits (not meaningful for circular setpoints)
+    bool soft_limits = config_.enable_soft_limits && !config_.setpoints_in_cpr
+            && !soft_limits_suspended_;
+    if (soft_limits && config_.control_mode >= CTRL_MODE_POSITION_CONTROL) {
+        pos_setpoint_ = std::max(config_.min_pos, std::min(pos_setpoint_, config_.max_pos));
+    }
+
+    // Input shaping
+    // The shaped commands are kept local so that the trajectory planner and
+    // step/dir still operate on the unshaped setpoints.
+    // Circular setpoints can't be delayed across the wrap, so they are not shaped.
+    InputShaper::Sample_t cmd = { pos_setpoint_, vel_setpoint_, current_setpoint_ };
+    if (config_.control_mode >= CTRL_MODE_VELOCITY_CONTROL && !config_.setpoints_in_cpr) {
+        cmd = input_shaper_.process(cmd);
+    } else {
+        input_shaper_.reset();
+    }
+
     // Position control
     // TODO Decide if we want to use encoder or pll position here
-    float vel_des = vel_setpoint_;
+    float vel_des = cmd.vel;
+    float pos_err = 0.0f;
     if (config_.control_mode >= CTRL_MODE_POSITION_CONTROL) {
-        float pos_err;
         if (config_.setpoints_in_cpr) {
             // TODO this breaks the semantics that estimates come in on the arguments.
             // It's probably better to call a get_estimate that will arbitrate (enc vs sensorless) instead.
@@ -155,16 +601,36 @@ bool Controller::update(float pos_estimate, float vel_estimate, float* current_s
             pos_err = pos_setpoint_ - axis_->encoder_.pos_cpr_;
             pos_err = wrap_pm(pos_err, 0.5f * cpr);
         } else {
-            pos_err = pos_setpoint_ - pos_estimate;
+            pos_err = cmd.pos - pos_estimate;
         }
         vel_des += config_.pos_gain * pos_err;
     }
 
+    // In-position event on entering the window, once the position setpoint is static
+    bool in_position = config_.control_mode == CTRL_MODE_POSITION_CONTROL
+            && config_.in_position_window > 0.0f // 0.0f to disable
+            && fabsf(pos_err) <= config_.in_position_window;
+    if (in_position && !in_position_)
+        axis_->raise_event(Axis::EVENT_IN_POSITION);
+    in_position_ = in_position;
+
     // Velocity limiting
     float vel_lim = config_.vel_limit;
     if (vel_des > vel_lim) vel_des = vel_lim;
     if (vel_des < -vel_lim) vel_des = -vel_lim;
 
+    // Limit the velocity towards each soft limit to what can still be stopped
+    // at limit_decel in the remaining distance: v^2 = 2 * a * d
+    float soft_vel_max = vel_lim;
+    float soft_vel_min = -vel_lim;
+    if (soft_limits) {
+        float two_decel = 2.0f * config_.limit_decel;
+        soft_vel_max = std::min(vel_lim, sqrtf(two_decel * std::max(0.0f, config_.max_pos - pos_estimate)));
+        soft_vel_min = std::max(-vel_lim, -sqrtf(two_decel * std::max(0.0f, pos_estimate - config_.min_pos)));
+        if (vel_des > soft_vel_max) vel_des = soft_vel_max;
+        if (vel_des < soft_vel_min) vel_des = soft_vel_min;
+    }
+
     // Check for overspeed fault (done in this module (controller) for cohesion with vel_lim)
     if (config_.vel_limit_tolerance > 0.0f) { // 0.0f to disable
         if (fabsf(vel_estimate) > config_.vel_limit_tolerance * vel_lim) {
@@ -173,8 +639,35 @@ bool Controller::update(float pos_estimate, float vel_estimate, float* current_s
         }
     }
 
+    // Load torque estimation, also used for collision/jam detection
+    if (!update_disturbance_observer(vel_estimate))
+        return false;
+    if (config_.load_torque_trip_level > 0.0f) { // 0.0f to disable
+        if (fabsf(load_torque_estimate_) > config_.load_torque_trip_level) {
+            set_error(ERROR_EXCESSIVE_LOAD_TORQUE);
+            return false;
+        }
+    }
+
+    // Online load identification, optionally retuning the feed-forward and velocity loop
+    update_inertia_estimate(vel_estimate);
+
     // Velocity control
-    float Iq = current_setpoint_;
+    float Iq = cmd.current;
+
+    // Compensate the estimated load torque ahead of the velocity integrator
+    // (the observer has checked torque_constant > 0)
+    if (config_.enable_disturbance_observer && config_.control_mode >= CTRL_MODE_VELOCITY_CONTROL) {
+        Iq += load_torque_estimate_ / axis_->motor_.config_.torque_constant;
+    }
+
+    // Friction feed-forward, driven by the velocity feed-forward rather than
+    // the measured velocity so that it doesn't add positive feedback, nor by
+    // vel_des, whose position error term would make it chatter around standstill
+    if (config_.enable_friction_ff && !friction_id_.running
+            && config_.control_mode >= CTRL_MODE_VELOCITY_CONTROL) {
+        Iq += friction_current(cmd.vel);
+    }
 
     // Anti-cogging is enabled after calibration
     // We get the current position and apply a current feed-forward
@@ -186,11 +679,24 @@ bool Controller::update(float pos_estimate, float vel_estimate, float* current_s
     float v_err = vel_des - vel_estimate;
     if (config_.control_mode >= CTRL_MODE_VELOCITY_CONTROL) {
         Iq += config_.vel_gain * v_err;
+        // Learned feed-forward for periodic motion; learns from the same error
+        Iq += repetitive_control_.update(pos_estimate, vel_estimate, v_err);
+    } else {
+        repetitive_control_.reset();
     }
 
     // Velocity integral action before limiting
     Iq += vel_integrator_current_;
 
+    // Without a velocity loop, brake with vel_gain when the axis is too fast
+    // to stop before a soft limit, and never push further past one
+    if (soft_limits && config_.control_mode < CTRL_MODE_VELOCITY_CONTROL) {
+        if (vel_estimate > soft_vel_max || pos_estimate > config_.max_pos)
+            Iq = std::min(Iq, config_.vel_gain * (soft_vel_max - vel_estimate));
+        if (vel_estimate < soft_vel_min || pos_estimate < config_.min_pos)
+            Iq = std::max(Iq, config_.vel_gain * (soft_vel_min - vel_estimate));
+    }
+
     // Current limiting
     bool limited = false;
     float Ilim = axis_->motor_.effective_current_lim();
@@ -216,6 +722,9 @@ bool Controller::update(float pos_estimate, float vel_estimate, float* current_s
         }
     }
 
+    // Only runs if friction_id_.running is true; non-blocking
+    friction_identification(vel_estimate, Iq);
+
     if (current_setpoint_output) *current_setpoint_output = Iq;
     return true;
 }
@@ -10,6 +10,10 @@ public:
     enum Error_t {
         ERROR_NONE = 0,
         ERROR_OVERSPEED = 0x01,
+        ERROR_EXCESSIVE_LOAD_TORQUE = 0x02,
+        ERROR_INVALID_GEARING_MASTER = 0x04,
+        ERROR_INVALID_LOAD_MODEL = 0x08,
+        ERROR_INVALID_INPUT_SHAPER = 0x10,
     };
 
     // Note: these should be sorted from lowest level of control to
@@ -19,9 +23,14 @@ public:
         CTRL_MODE_CURRENT_CONTROL = 1,
         CTRL_MODE_VELOCITY_CONTROL = 2,
         CTRL_MODE_POSITION_CONTROL = 3,
-        CTRL_MODE_TRAJECTORY_CONTROL = 4
+        CTRL_MODE_TRAJECTORY_CONTROL = 4,
+        CTRL_MODE_GEARING = 5,
+        CTRL_MODE_PVT = 6,
+        CTRL_MODE_MOTION_TABLE = 7
     };
 
+    static constexpr size_t kCamTableSize = 32;
+
     struct Config_t {
         ControlMode_t control_mode = CTRL_MODE_POSITION_CONTROL;  //see: Motor_control_mode_t
         float pos_gain = 20.0f;  // [(counts/s) / counts]
@@ -32,6 +41,34 @@ public:
         float vel_limit_tolerance = 1.2f;  // ratio to vel_lim. 0.0f to disable
         float vel_ramp_rate = 10000.0f;  // [(counts/s) / s]
         bool setpoints_in_cpr = false;
+        bool enable_disturbance_observer = false; // feed the load torque estimate forward into the current setpoint
+        float inertia = 0.0f;              // [kg*m^2] total inertia of rotor and load, as seen by the motor
+        float dob_bandwidth = 200.0f;      // [rad/s] bandwidth of the load torque estimate
+        float load_torque_trip_level = 0.0f; // [Nm] 0.0f to disable
+        float in_position_window = 10.0f;  // [counts] position error for the in-position event, 0.0f to disable
+        bool enable_soft_limits = false;
+        float min_pos = 0.0f;              // [counts]
+        float max_pos = 0.0f;              // [counts]
+        float limit_decel = 20000.0f;      // [(counts/s) / s] deceleration used to stop before a limit
+        InputShaper::Config_t input_shaper;
+        RepetitiveController::Config_t repetitive_control;
+        InertiaEstimator::Config_t inertia_estimator;
+        PvtFifo::Config_t pvt;
+        MotionTable::Config_t motion_table;
+        int32_t gearing_master_axis = 0;   // axis whose encoder is followed in CTRL_MODE_GEARING
+        float gear_ratio = 1.0f;           // [counts/master count]
+        bool enable_cam = false;           // add the cam table on top of the gear ratio
+        float cam_period = 8192.0f;        // [master counts] master distance covered by the cam table
+        float cam_table[kCamTableSize] = { 0.0f }; // [counts] equally spaced over one cam period
+        bool enable_friction_ff = false;
+        float friction_coulomb = 0.0f;     // [A]
+        float friction_viscous = 0.0f;     // [A/(counts/s)]
+        float friction_stribeck = 0.0f;    // [A] extra breakaway current at standstill
+        float stribeck_vel = 200.0f;       // [counts/s] speed at which the Stribeck term has decayed to 1/e
+        float friction_smoothing_vel = 50.0f; // [counts/s] width of the smooth sign function around zero
+        float friction_id_max_vel = 5000.0f;  // [counts/s] highest speed of the identification sweep
+        int32_t friction_id_steps = 8;     // number of speeds per direction in the identification sweep
+        float friction_id_step_time = 1.0f; // [s] time per speed, the first half of which is for settling
     };
 
     explicit Controller(Config_t& config);
@@ -43,6 +80,9 @@ public:
     void set_current_setpoint(float current_setpoint);
 
     // Trajectory-Planned control
+    void plan_trajectory(float goal_point, float vel_limit, float accel_limit,
+                         float decel_limit, float jerk_limit);
+    void start_trajectory();
     void move_to_pos(float goal_point);
     void move_incremental(float displacement, bool from_goal_point);
     
@@ -50,10 +90,27 @@ public:
     void start_anticogging_calibration();
     bool anticogging_calibration(float pos_estimate, float vel_estimate);
 
+    void start_friction_identification();
+    void friction_identification(float vel_estimate, float current);
+    float friction_current(float vel);
+    float friction_id_vel(int32_t step);
+    void set_cam_point(int32_t index, float value);
+    float get_cam_point(int32_t index);
+    bool update_gearing();
+    void update_pvt();
+    bool start_motion_table();
+    void update_motion_table();
+    bool update_disturbance_observer(float vel_estimate);
+    void update_inertia_estimate(float vel_estimate);
     bool update(float pos_estimate, float vel_estimate, float* current_setpoint);
 
     Config_t& config_;
     Axis* axis_ = nullptr; // set by Axis constructor
+    InputShaper input_shaper_;
+    RepetitiveController repetitive_control_;
+    InertiaEstimator inertia_estimator_;
+    PvtFifo pvt_;
+    MotionTable motion_table_;
 
     // TODO: anticogging overhaul:
     // - expose selected (all?) variables on protocol
@@ -89,8 +146,39 @@ public:
     bool vel_ramp_enable_ = false;
 
     uint32_t traj_start_loop_count_ = 0;
+    bool traj_is_scurve_ = false;
 
     float goal_point_ = 0.0f;
+    bool in_position_ = false;
+
+    struct FrictionId_t {
+        bool running = false;
+        int32_t step = 0;        // speeds 0..N-1 forwards, N..2N-1 backwards
+        uint32_t ticks = 0;      // control loop ticks spent at the current speed
+        float vel_sum = 0.0f;    // [counts/s] sums over the measurement window
+        float current_sum = 0.0f; // [A]
+        uint32_t samples = 0;
+        // Normal equations of the least squares fit current = Fc * sign(v) + Fv * v
+        float s_ss = 0.0f, s_sv = 0.0f, s_vv = 0.0f, s_si = 0.0f, s_vi = 0.0f;
+        // Mean current at the lowest speed of each direction, for the Stribeck term
+        float low_speed_vel[2] = { 0.0f, 0.0f };
+        float low_speed_current[2] = { 0.0f, 0.0f };
+    };
+    FrictionId_t friction_id_;
+
+    bool pvt_active_ = false;
+    bool motion_table_active_ = false;
+
+    bool soft_limits_suspended_ = false;   // set by homing while the position is not known
+
+    bool gearing_active_ = false;
+    int16_t gearing_master_sample_ = 0;
+    int32_t gearing_master_count_ = 0;     // [master counts]
+    int32_t gearing_master_ref_ = 0;       // [master counts]
+    float gearing_slave_ref_ = 0.0f;       // [counts]
+
+    float dob_state_ = 0.0f;               // [Nm] internal state of the disturbance observer
+    float load_torque_estimate_ = 0.0f;    // [Nm]
 
     // Communication protocol definitions
     auto make_protocol_definitions() {
@@ -102,6 +190,8 @@ public:
             make_protocol_property("current_setpoint", &current_setpoint_),
             make_protocol_property("vel_ramp_target", &vel_ramp_target_),
             make_protocol_property("vel_ramp_enable", &vel_ramp_enable_),
+            make_protocol_ro_property("load_torque_estimate", &load_torque_estimate_),
+            make_protocol_ro_property("in_position", &in_position_),
             make_protocol_object("config",
                 make_protocol_property("control_mode", &config_.control_mode),
                 make_protocol_property("pos_gain", &config_.pos_gain),
@@ -110,8 +200,36 @@ public:
                 make_protocol_property("vel_limit", &config_.vel_limit),
                 make_protocol_property("vel_limit_tolerance", &config_.vel_limit_tolerance),
                 make_protocol_property("vel_ramp_rate", &config_.vel_ramp_rate),
-                make_protocol_property("setpoints_in_cpr", &config_.setpoints_in_cpr)
+                make_protocol_property("setpoints_in_cpr", &config_.setpoints_in_cpr),
+                make_protocol_property("enable_disturbance_observer", &config_.enable_disturbance_observer),
+                make_protocol_property("inertia", &config_.inertia),
+                make_protocol_property("dob_bandwidth", &config_.dob_bandwidth),
+                make_protocol_property("load_torque_trip_level", &config_.load_torque_trip_level),
+                make_protocol_property("in_position_window", &config_.in_position_window),
+                make_protocol_property("enable_soft_limits", &config_.enable_soft_limits),
+                make_protocol_property("min_pos", &config_.min_pos),
+                make_protocol_property("max_pos", &config_.max_pos),
+                make_protocol_property("limit_decel", &config_.limit_decel),
+                make_protocol_property("gearing_master_axis", &config_.gearing_master_axis),
+                make_protocol_property("gear_ratio", &config_.gear_ratio),
+                make_protocol_property("enable_cam", &config_.enable_cam),
+                make_protocol_property("cam_period", &config_.cam_period),
+                make_protocol_property("enable_friction_ff", &config_.enable_friction_ff),
+                make_protocol_property("friction_coulomb", &config_.friction_coulomb),
+                make_protocol_property("friction_viscous", &config_.friction_viscous),
+                make_protocol_property("friction_stribeck", &config_.friction_stribeck),
+                make_protocol_property("stribeck_vel", &config_.stribeck_vel),
+                make_protocol_property("friction_smoothing_vel", &config_.friction_smoothing_vel),
+                make_protocol_property("friction_id_max_vel", &config_.friction_id_max_vel),
+                make_protocol_property("friction_id_steps", &config_.friction_id_steps),
+                make_protocol_property("friction_id_step_time", &config_.friction_id_step_time)
             ),
+            make_protocol_ro_property("friction_identification_running", &friction_id_.running),
+            make_protocol_object("input_shaper", input_shaper_.make_protocol_definitions()),
+            make_protocol_object("repetitive_control", repetitive_control_.make_protocol_definitions()),
+            make_protocol_object("inertia_estimator", inertia_estimator_.make_protocol_definitions()),
+            make_protocol_object("pvt", pvt_.make_protocol_definitions()),
+            make_protocol_object("motion_table", motion_table_.make_protocol_definitions()),
             make_protocol_function("set_pos_setpoint", *this, &Controller::set_pos_setpoint,
                 "pos_setpoint", "vel_feed_forward", "current_feed_forward"),
             make_protocol_function("set_vel_setpoint", *this, &Controller::set_vel_setpoint,
@@ -120,11 +238,17 @@ public:
                                    "current_setpoint"),
             make_protocol_function("move_to_pos", *this, &Controller::move_to_pos, "pos_setpoint"),
             make_protocol_function("move_incremental", *this, &Controller::move_incremental, "displacement", "from_goal_point"),
-            make_protocol_function("start_anticogging_calibration", *this, &Controller::start_anticogging_calibration)
+            make_protocol_function("start_motion_table", *this, &Controller::start_motion_table),
+            make_protocol_function("start_anticogging_calibration", *this, &Controller::start_anticogging_calibration),
+            make_protocol_function("start_friction_identification", *this, &Controller::start_friction_identification),
+            make_protocol_function("set_cam_point", *this, &Controller::set_cam_point, "index", "value"),
+            make_protocol_function("get_cam_point", *this, &Controller::get_cam_point, "index")
         );
     }
 };
 
 DEFINE_ENUM_FLAG_OPERATORS(Controller::Error_t)
 
+bool move_coordinated(const float goal_points[]);
+
 #endif // __CONTROLLER_HPP
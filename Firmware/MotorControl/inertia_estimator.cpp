@@ -0,0 +1,105 @@
+
+#include "odrive_main.h"
+
+InertiaEstimator::InertiaEstimator(Config_t& config) :
+    config_(config)
+{
+    reset();
+}
+
+// @brief Forgets the estimates and restarts the fit from scratch.
+void InertiaEstimator::reset() {
+    static const float P_init = 100.0f; // large initial covariance: no confidence in the zero estimate
+    for (size_t i = 0; i < kNumParams; ++i) {
+        theta_[i] = 0.0f;
+        for (size_t j = 0; j < kNumParams; ++j)
+            P_[i][j] = (i == j) ? P_init : 0.0f;
+    }
+    A_per_css_ = 0.0f;
+    viscous_ = 0.0f;
+    coulomb_ = 0.0f;
+    num_updates_ = 0;
+    ticks_ = 0;
+    vel_sum_ = 0.0f;
+    Iq_sum_ = 0.0f;
+    have_prev_ = false;
+}
+
+// @brief Runs one control tick.
+// Velocity and current are averaged over kDecimation ticks. The acceleration
+// is the difference of successive velocity averages, and is paired with the
+// mean current of the same two windows so that both are centered on the same
+// instant. The regressors are normalized by accel_scale and vel_scale to
+// keep the covariance well conditioned in single precision.
+// @returns true if the estimates were updated in this tick
+bool InertiaEstimator::update(float vel_estimate, float Iq, float accel_scale, float vel_scale) {
+    if (!config_.enabled) {
+        have_prev_ = false;
+        ticks_ = 0;
+        vel_sum_ = 0.0f;
+        Iq_sum_ = 0.0f;
+        return false;
+    }
+
+    vel_sum_ += vel_estimate;
+    Iq_sum_ += Iq;
+    if (++ticks_ < kDecimation)
+        return false;
+
+    float vel_mean = vel_sum_ * (1.0f / (float)kDecimation);
+    float Iq_mean = Iq_sum_ * (1.0f / (float)kDecimation);
+    ticks_ = 0;
+    vel_sum_ = 0.0f;
+    Iq_sum_ = 0.0f;
+
+    float dt = (float)kDecimation * current_meas_period;
+    float accel = (vel_mean - vel_mean_prev_) / dt;
+    float vel = 0.5f * (vel_mean + vel_mean_prev_);
+    float y = 0.5f * (Iq_mean + Iq_mean_prev_);
+    bool have_prev = have_prev_;
+    vel_mean_prev_ = vel_mean;
+    Iq_mean_prev_ = Iq_mean;
+    have_prev_ = true;
+
+    // Without excitation the covariance would wind up under forgetting
+    if (!have_prev || fabsf(accel) < config_.min_accel
+            || !(accel_scale > 0.0f) || !(vel_scale > 0.0f))
+        return false;
+
+    float phi[kNumParams] = {
+        accel / accel_scale,
+        vel / vel_scale,
+        (vel > 0.0f) ? 1.0f : ((vel < 0.0f) ? -1.0f : 0.0f)
+    };
+
+    // K = P*phi / (lambda + phi'*P*phi)
+    float P_phi[kNumParams];
+    float denom = config_.forgetting_factor;
+    for (size_t i = 0; i < kNumParams; ++i) {
+        P_phi[i] = 0.0f;
+        for (size_t j = 0; j < kNumParams; ++j)
+            P_phi[i] += P_[i][j] * phi[j];
+        denom += phi[i] * P_phi[i];
+    }
+    if (!(denom > 0.0f))
+        return false;
+
+    float err = y;
+    for (size_t i = 0; i < kNumParams; ++i)
+        err -= phi[i] * theta_[i];
+
+    // theta += K*err, P = (P - K*phi'*P) / lambda
+    float inv_lambda = 1.0f / config_.forgetting_factor;
+    for (size_t i = 0; i < kNumParams; ++i) {
+        float K_i = P_phi[i] / denom;
+        theta_[i] += K_i * err;
+        for (size_t j = 0; j < kNumParams; ++j)
+            P_[i][j] = (P_[i][j] - K_i * P_phi[j]) * inv_lambda;
+    }
+
+    A_per_css_ = theta_[0] / accel_scale;
+    viscous_ = theta_[1] / vel_scale;
+    coulomb_ = theta_[2];
+    ++num_updates_;
+    return true;
+}
@@ -0,0 +1,80 @@
+#ifndef __INERTIA_ESTIMATOR_HPP
+#define __INERTIA_ESTIMATOR_HPP
+
+#ifndef __ODRIVE_MAIN_H
+#error "This file should not be included directly. Include odrive_main.h instead."
+#endif
+
+// @brief Fits the load model
+//   Iq = A_per_css * accel + viscous * vel + coulomb * sign(vel)
+// to the measured current and velocity by recursive least squares with
+// exponential forgetting, so that the estimate follows load changes.
+class InertiaEstimator {
+public:
+    struct Config_t {
+        bool enabled = false;
+        float forgetting_factor = 0.998f; // per update, at current_meas_hz / kDecimation
+        float min_accel = 1000.0f;        // [counts/s^2] updates are skipped below this acceleration
+        bool update_A_per_css = false;    // write the estimate to trap_traj.config.A_per_css
+        float A_per_css_min = 0.0f;       // [A/(counts/s^2)]
+        float A_per_css_max = 1e-3f;      // [A/(counts/s^2)]
+        bool update_vel_gain = false;     // rescale the velocity loop gains with the estimated inertia
+        float vel_loop_bandwidth = 100.0f; // [rad/s] vel_gain = A_per_css * vel_loop_bandwidth
+        float vel_gain_min = 1e-4f;       // [A/(counts/s)]
+        float vel_gain_max = 5e-3f;       // [A/(counts/s)]
+    };
+
+    static constexpr size_t kNumParams = 3;
+    static constexpr uint32_t kDecimation = 8;
+    static constexpr uint32_t kMinUpdatesToApply = 100; // before the estimate is written to the config
+
+    explicit InertiaEstimator(Config_t& config);
+
+    void reset();
+    bool update(float vel_estimate, float Iq, float accel_scale, float vel_scale);
+
+    Config_t& config_;
+
+    // Estimates
+    float A_per_css_ = 0.0f;    // [A/(counts/s^2)]
+    float viscous_ = 0.0f;      // [A/(counts/s)]
+    float coulomb_ = 0.0f;      // [A]
+    uint32_t num_updates_ = 0;
+
+    // RLS state, on regressors normalized by accel_scale and vel_scale
+    float theta_[kNumParams] = { 0.0f };
+    float P_[kNumParams][kNumParams] = {{ 0.0f }};
+
+    // Decimation, averaging over kDecimation ticks
+    uint32_t ticks_ = 0;
+    float vel_sum_ = 0.0f;
+    float Iq_sum_ = 0.0f;
+    float vel_mean_prev_ = 0.0f;
+    float Iq_mean_prev_ = 0.0f;
+    bool have_prev_ = false;
+
+    // Communication protocol definitions
+    auto make_protocol_definitions() {
+        return make_protocol_member_list(
+            make_protocol_ro_property("A_per_css", &A_per_css_),
+            make_protocol_ro_property("viscous", &viscous_),
+            make_protocol_ro_property("coulomb", &coulomb_),
+            make_protocol_ro_property("num_updates", &num_updates_),
+            make_protocol_object("config",
+                make_protocol_property("enabled", &config_.enabled),
+                make_protocol_property("forgetting_factor", &config_.forgetting_factor),
+                make_protocol_property("min_accel", &config_.min_accel),
+                make_protocol_property("update_A_per_css", &config_.update_A_per_css),
+                make_protocol_property("A_per_css_min", &config_.A_per_css_min),
+                make_protocol_property("A_per_css_max", &config_.A_per_css_max),
+                make_protocol_property("update_vel_gain", &config_.update_vel_gain),
+                make_protocol_property("vel_loop_bandwidth", &config_.vel_loop_bandwidth),
+                make_protocol_property("vel_gain_min", &config_.vel_gain_min),
+                make_protocol_property("vel_gain_max", &config_.vel_gain_max)
+            ),
+            make_protocol_function("reset", *this, &InertiaEstimator::reset)
+        );
+    }
+};
+
+#endif // __INERTIA_ESTIMATOR_HPP
@@ -0,0 +1,117 @@
+
+#include <stdlib.h>
+#include "odrive_main.h"
+
+InputShaper::InputShaper(Config_t& config) :
+    config_(config)
+{
+    if (config_.type != TYPE_NONE && compute_impulses()) {
+        size_t required_size = delays_[num_impulses_ - 1] + 1;
+        if (required_size <= kMaxBufferSize) {
+            buffer_ = (Sample_t*)malloc(required_size * sizeof(Sample_t));
+            buffer_size_ = buffer_ ? required_size : 0;
+        }
+    }
+}
+
+// @brief Computes the impulse train from the config and checks that it fits
+// into the delay buffer.
+// Must not be called concurrently with process(), i.e. only from the axis
+// thread while the control loop is not running.
+// @returns false if the shaper is enabled but the config is invalid or its
+// longest delay does not fit into the buffer. The shaper is inactive then.
+bool InputShaper::setup() {
+    active_ = false;
+    primed_ = false;
+
+    if (config_.type == TYPE_NONE)
+        return true;
+    if (!compute_impulses())
+        return false;
+    if (delays_[num_impulses_ - 1] >= buffer_size_)
+        return false;
+
+    head_ = 0;
+    active_ = true;
+    return true;
+}
+
+bool InputShaper::compute_impulses() {
+    num_impulses_ = 0;
+
+    float zeta = config_.damping;
+    if (!(config_.frequency > 0.0f) || !(zeta >= 0.0f && zeta < 1.0f))
+        return false;
+
+    float sqrt_one_minus_zeta_sq = sqrtf(1.0f - zeta * zeta);
+    float half_period = 0.5f / (config_.frequency * sqrt_one_minus_zeta_sq); // [s] half the damped period
+    float K = expf(-zeta * M_PI / sqrt_one_minus_zeta_sq);
+
+    switch (config_.type) {
+        case TYPE_ZV: {
+            num_impulses_ = 2;
+            amplitudes_[0] = 1.0f / (1.0f + K);
+            amplitudes_[1] = K / (1.0f + K);
+        } break;
+
+        case TYPE_ZVD: {
+            float norm = 1.0f / SQ(1.0f + K);
+            num_impulses_ = 3;
+            amplitudes_[0] = norm;
+            amplitudes_[1] = 2.0f * K * norm;
+            amplitudes_[2] = K * K * norm;
+        } break;
+
+        case TYPE_EI: {
+            static const float V = 0.05f; // tolerable residual vibration
+            num_impulses_ = 3;
+            amplitudes_[0] = 0.25f * (1.0f + V);
+            amplitudes_[1] = 0.5f * (1.0f - V);
+            amplitudes_[2] = 0.25f * (1.0f + V);
+        } break;
+
+        default: {
+            return false;
+        } break;
+    }
+
+    // Also keeps the conversion below in range
+    if ((num_impulses_ - 1) * half_period * current_meas_hz >= kMaxBufferSize) {
+        num_impulses_ = 0;
+        return false;
+    }
+    for (size_t i = 0; i < num_impulses_; ++i)
+        delays_[i] = static_cast<size_t>(i * half_period * current_meas_hz + 0.5f);
+    return true;
+}
+
+// @brief Makes the next call to process() fill the delay buffer with its input,
+// so that the shaper starts from a steady state instead of a step.
+void InputShaper::reset() {
+    primed_ = false;
+}
+
+InputShaper::Sample_t InputShaper::process(const Sample_t& input) {
+    if (!active_)
+        return input;
+
+    if (!primed_) {
+        for (size_t i = 0; i < buffer_size_; ++i)
+            buffer_[i] = input;
+        primed_ = true;
+    }
+
+    buffer_[head_] = input;
+
+    Sample_t output = { 0.0f, 0.0f, 0.0f };
+    for (size_t i = 0; i < num_impulses_; ++i) {
+        size_t idx = (head_ + buffer_size_ - delays_[i]) % buffer_size_;
+        output.pos += amplitudes_[i] * buffer_[idx].pos;
+        output.vel += amplitudes_[i] * buffer_[idx].vel;
+        output.current += amplitudes_[i] * buffer_[idx].current;
+    }
+
+    if (++head_ >= buffer_size_)
+        head_ = 0;
+    return output;
+}
@@ -0,0 +1,75 @@
+#ifndef __INPUT_SHAPER_HPP
+#define __INPUT_SHAPER_HPP
+
+#ifndef __ODRIVE_MAIN_H
+#error "This file should not be included directly. Include odrive_main.h instead."
+#endif
+
+// @brief Shapes the position/velocity/current commands with a train of
+// delayed impulses, such that the commands do not excite a structural
+// resonance of the load.
+class InputShaper {
+public:
+    enum Type_t {
+        TYPE_NONE = 0,
+        TYPE_ZV = 1,    // zero vibration, 2 impulses, delay = half the damped period
+        TYPE_ZVD = 2,   // zero vibration and derivative, 3 impulses, delay = damped period
+        TYPE_EI = 3,    // extra insensitive (5% vibration tolerance), 3 impulses, delay = damped period
+    };
+
+    struct Config_t {
+        Type_t type = TYPE_NONE;
+        float frequency = 20.0f; // [Hz] natural frequency of the mode to suppress
+        float damping = 0.05f;   // damping ratio of the mode to suppress
+    };
+
+    struct Sample_t {
+        float pos;
+        float vel;
+        float current;
+    };
+
+    static constexpr size_t kMaxImpulses = 3;
+    // Bound on the delay buffer [control loop ticks]. At 8kHz this is 0.2s,
+    // i.e. ZV down to 2.5Hz and ZVD/EI down to 5Hz.
+    static constexpr size_t kMaxBufferSize = 1600;
+
+    explicit InputShaper(Config_t& config);
+
+    bool setup();
+    void reset();
+    Sample_t process(const Sample_t& input);
+
+    Config_t& config_;
+
+    // Impulse train, computed from the config by setup()
+    size_t num_impulses_ = 0;
+    float amplitudes_[kMaxImpulses] = { 0.0f };
+    size_t delays_[kMaxImpulses] = { 0 }; // [control loop ticks]
+
+    // Circular delay buffer, allocated once by the constructor to hold the
+    // longest delay of the config at startup
+    Sample_t* buffer_ = nullptr;
+    size_t buffer_size_ = 0;
+    size_t head_ = 0;
+    bool primed_ = false;
+    bool active_ = false;
+
+private:
+    bool compute_impulses();
+
+public:
+    // Communication protocol definitions
+    auto make_protocol_definitions() {
+        return make_protocol_member_list(
+            make_protocol_ro_property("active", &active_),
+            make_protocol_object("config",
+                make_protocol_property("type", &config_.type),
+                make_protocol_property("frequency", &config_.frequency),
+                make_protocol_property("damping", &config_.damping)
+            )
+        );
+    }
+};
+
+#endif // __INPUT_SHAPER_HPP
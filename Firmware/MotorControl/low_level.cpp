@@ -32,17 +32,36 @@ const float adc_full_scale = (float)(1 << 12);
 const float adc_ref_voltage = 3.3f;
 /* Global variables ----------------------------------------------------------*/
 
-// This value is updated by the DC-bus reading ADC.
+// These values are updated by the DC-bus reading ADC.
+// vbus_voltage is used by the protection logic and optionally low pass filtered,
+// vbus_voltage_instant is the latest sample.
 // Arbitrary non-zero inital value to avoid division by zero if ADC reading is late
 float vbus_voltage = 12.0f;
+float vbus_voltage_instant = 12.0f;
 bool brake_resistor_armed = false;
+// Mean sampling instant of the oversampled current measurement, relative to
+// the first conversion, see config_simultaneous_adc
+float current_meas_delay = 0.0f;
+// DMA of the Motor 1 current samples
+DMA_HandleTypeDef hdma_adc2;
+DMA_HandleTypeDef hdma_adc3;
 /* Private constant data -----------------------------------------------------*/
+// The ADC clock is PCLK2 / 4 = 21MHz, and the current and vbus channels take
+// 3 sampling + 12 conversion cycles
+static const float adc_conversion_time = 15.0f / 21e6f;
 static const GPIO_TypeDef* GPIOs_to_samp[] = { GPIOA, GPIOB, GPIOC };
 static const int num_GPIO = sizeof(GPIOs_to_samp) / sizeof(GPIOs_to_samp[0]); 
 /* Private variables ---------------------------------------------------------*/
 
 // Two motors, sampling port A,B,C (coherent with current meas timing)
 static uint16_t GPIO_port_samples [2][num_GPIO];
+// Whether the ADCs are set up for simultaneous sampling, see config_simultaneous_adc
+static bool simultaneous_adc = false;
+// Number of conversions averaged per current (and vbus) measurement
+static uint32_t n_current_samples = 1;
+// Motor 1 current samples of the regular groups of ADC2 and ADC3, written by DMA
+static uint16_t adc2_regular_samples_[CURRENT_MEAS_MAX_OVERSAMPLING];
+static uint16_t adc3_regular_samples_[CURRENT_MEAS_MAX_OVERSAMPLING];
 /* CPU critical section helpers ----------------------------------------------*/
 
 /* Safety critical functions -------------------------------------------------*/
@@ -196,18 +215,135 @@ void safety_critical_apply_brake_resistor_timings(uint32_t low_off, uint32_t hig
 
 /* Function implementations --------------------------------------------------*/
 
+// @brief Repeats the channel that MX_ADCx_Init set up for the injected group
+// n times, so that the sequence converts it back to back on each trigger.
+static void config_injected_oversampling(ADC_HandleTypeDef* hadc, uint32_t n) {
+    ADC_InjectionConfTypeDef sConfigInjected;
+    // With a single conversion the channel is in the last slot of JSQR
+    sConfigInjected.InjectedChannel = (hadc->Instance->JSQR & ADC_JSQR_JSQ4) >> ADC_JSQR_JSQ4_Pos;
+    sConfigInjected.InjectedNbrOfConversion = n;
+    sConfigInjected.InjectedSamplingTime = ADC_SAMPLETIME_3CYCLES;
+    sConfigInjected.ExternalTrigInjecConvEdge = ADC_EXTERNALTRIGINJECCONVEDGE_RISING;
+    sConfigInjected.ExternalTrigInjecConv = ADC_EXTERNALTRIGINJECCONV_T1_TRGO;
+    sConfigInjected.AutoInjectedConv = DISABLE;
+    sConfigInjected.InjectedDiscontinuousConvMode = DISABLE;
+    sConfigInjected.InjectedOffset = 0;
+    for (uint32_t rank = 1; rank <= n; ++rank) {
+        sConfigInjected.InjectedRank = rank;
+        if (HAL_ADCEx_InjectedConfigChannel(hadc, &sConfigInjected) != HAL_OK)
+            _Error_Handler((char*)__FILE__, __LINE__);
+    }
+}
+
+// @brief Repeats the channel that MX_ADCx_Init set up for the regular group
+// n times. The regular group has a single data register, so each conversion
+// is copied to samples by DMA, which wraps around at the end of the sequence.
+static void config_regular_oversampling(ADC_HandleTypeDef* hadc, uint32_t n,
+        DMA_HandleTypeDef* hdma, DMA_Stream_TypeDef* stream, uint32_t dma_channel,
+        uint32_t dma_priority, uint16_t* samples) {
+    ADC_ChannelConfTypeDef sConfig;
+    sConfig.Channel = (hadc->Instance->SQR3 & ADC_SQR3_SQ1) >> ADC_SQR3_SQ1_Pos;
+    sConfig.SamplingTime = ADC_SAMPLETIME_3CYCLES;
+
+    hadc->Init.ScanConvMode = ENABLE;
+    hadc->Init.NbrOfConversion = n;
+    hadc->Init.DMAContinuousRequests = ENABLE;
+    hadc->Init.EOCSelection = ADC_EOC_SEQ_CONV;
+    if (HAL_ADC_Init(hadc) != HAL_OK)
+        _Error_Handler((char*)__FILE__, __LINE__);
+    for (uint32_t rank = 1; rank <= n; ++rank) {
+        sConfig.Rank = rank;
+        if (HAL_ADC_ConfigChannel(hadc, &sConfig) != HAL_OK)
+            _Error_Handler((char*)__FILE__, __LINE__);
+    }
+
+    hdma->Instance = stream;
+    hdma->Init.Channel = dma_channel;
+    hdma->Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma->Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma->Init.MemInc = DMA_MINC_ENABLE;
+    hdma->Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+    hdma->Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+    hdma->Init.Mode = DMA_CIRCULAR;
+    hdma->Init.Priority = dma_priority;
+    hdma->Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    if (HAL_DMA_Init(hdma) != HAL_OK)
+        _Error_Handler((char*)__FILE__, __LINE__);
+    if (HAL_DMA_Start(hdma, (uint32_t)&hadc->Instance->DR, (uint32_t)samples, n) != HAL_OK)
+        _Error_Handler((char*)__FILE__, __LINE__);
+    hadc->Instance->CR2 |= ADC_CR2_DMA;
+}
+
+// @brief Sets up the ADCs to sample both phase currents of a motor (and, for
+// M0, the bus voltage) with one sequence per trigger and a single interrupt,
+// see pwm_trig_adc_cb. Each current measurement converts the phase currents
+// (and vbus) n_current_samples times back to back, and pwm_trig_adc_cb
+// averages them. Their mean is sampled current_meas_delay after the first
+// conversion, which is compensated in Motor::FOC_current.
+static void config_simultaneous_adc() {
+    n_current_samples = board_config.current_meas_oversampling;
+    if (n_current_samples < 1)
+        n_current_samples = 1;
+    if (n_current_samples > CURRENT_MEAS_MAX_OVERSAMPLING)
+        n_current_samples = CURRENT_MEAS_MAX_OVERSAMPLING;
+    current_meas_delay = 0.5f * (float)(n_current_samples - 1) * adc_conversion_time;
+
+    // Motor 0 and vbus: the injected sequences must have the same length in
+    // simultaneous mode
+    config_injected_oversampling(&hadc1, n_current_samples);
+    config_injected_oversampling(&hadc2, n_current_samples);
+    config_injected_oversampling(&hadc3, n_current_samples);
+    // Motor 1: ADC3 signals the end of the measurement with the transfer
+    // complete interrupt of its DMA stream. ADC2 finishes on the same cycle,
+    // and its stream has the higher priority, so its transfer is normally
+    // done first (pwm_trig_adc_cb waits for it if not).
+    config_regular_oversampling(&hadc2, n_current_samples, &hdma_adc2, DMA2_Stream2,
+            DMA_CHANNEL_1, DMA_PRIORITY_VERY_HIGH, adc2_regular_samples_);
+    config_regular_oversampling(&hadc3, n_current_samples, &hdma_adc3, DMA2_Stream1,
+            DMA_CHANNEL_2, DMA_PRIORITY_HIGH, adc3_regular_samples_);
+    __HAL_DMA_ENABLE_IT(&hdma_adc3, DMA_IT_TC);
+    // Same priority as the ADC interrupt, so that the callbacks don't preempt each other
+    HAL_NVIC_SetPriority(DMA2_Stream1_IRQn, 5, 0);
+    HAL_NVIC_EnableIRQ(DMA2_Stream1_IRQn);
+
+    // The injected groups of ADC1 (vbus), ADC2 (M0 phase B) and ADC3 (M0 phase C)
+    // convert simultaneously on the TIM1 trigger of ADC1. The regular groups
+    // stay independent: ADC2 and ADC3 sample M1 on the TIM8 trigger, and ADC1
+    // runs the general purpose sequence. Regular simultaneous mode would tie
+    // that sequence to TIM8, so M1 has no bus voltage sample of its own.
+    ADC_MultiModeTypeDef multimode;
+    multimode.Mode = ADC_TRIPLEMODE_INJECSIMULT;
+    multimode.DMAAccessMode = ADC_DMAACCESSMODE_DISABLED;
+    multimode.TwoSamplingDelay = ADC_TWOSAMPLINGDELAY_5CYCLES;
+    if (HAL_ADCEx_MultiModeConfigChannel(&hadc1, &multimode) != HAL_OK)
+        _Error_Handler((char*)__FILE__, __LINE__);
+    // The slaves are triggered by the master
+    hadc2.Instance->CR2 &= ~ADC_CR2_JEXTEN;
+    hadc3.Instance->CR2 &= ~ADC_CR2_JEXTEN;
+}
+
 void start_adc_pwm() {
+    // Changes to the ADC setup take effect after a reboot
+    simultaneous_adc = board_config.enable_simultaneous_adc;
+    if (simultaneous_adc)
+        config_simultaneous_adc();
+
     // Enable ADC and interrupts
     __HAL_ADC_ENABLE(&hadc1);
     __HAL_ADC_ENABLE(&hadc2);
     __HAL_ADC_ENABLE(&hadc3);
     // Warp field stabilize.
     osDelay(2);
-    __HAL_ADC_ENABLE_IT(&hadc1, ADC_IT_JEOC);
-    __HAL_ADC_ENABLE_IT(&hadc2, ADC_IT_JEOC);
-    __HAL_ADC_ENABLE_IT(&hadc3, ADC_IT_JEOC);
-    __HAL_ADC_ENABLE_IT(&hadc2, ADC_IT_EOC);
-    __HAL_ADC_ENABLE_IT(&hadc3, ADC_IT_EOC);
+    if (simultaneous_adc) {
+        // ADC1 and ADC2 finish together with ADC3 and are read in its interrupt
+        __HAL_ADC_ENABLE_IT(&hadc3, ADC_IT_JEOC);
+    } else {
+        __HAL_ADC_ENABLE_IT(&hadc1, ADC_IT_JEOC);
+        __HAL_ADC_ENABLE_IT(&hadc2, ADC_IT_JEOC);
+        __HAL_ADC_ENABLE_IT(&hadc3, ADC_IT_JEOC);
+        __HAL_ADC_ENABLE_IT(&hadc2, ADC_IT_EOC);
+        __HAL_ADC_ENABLE_IT(&hadc3, ADC_IT_EOC);
+    }
 
     // Ensure that debug halting of the core doesn't leave the motor PWM running
     __HAL_DBGMCU_FREEZE_TIM1();
@@ -322,7 +458,8 @@ uint16_t adc_measurements_[ADC_CHANNEL_COUNT] = { 0 };
 // DMA is used to copy the measured 12-bit values to adc_measurements_.
 //
 // The injected (high priority) channel of ADC1 is used to sample vbus_voltage.
-// This conversion is triggered by TIM1 at the frequency of the motor control loop.
+// This conversion is triggered by TIM1 at the frequency of the motor control loop,
+// simultaneously with the current measurements of M0 (see start_adc_pwm).
 void start_general_purpose_adc() {
     ADC_ChannelConfTypeDef sConfig;
 
@@ -423,13 +560,29 @@ float get_adc_voltage(GPIO_TypeDef* GPIO_port, uint16_t GPIO_pin) {
 
 void vbus_sense_adc_cb(ADC_HandleTypeDef* hadc, bool injected) {
     static const float voltage_scale = adc_ref_voltage * VBUS_S_DIVIDER_RATIO / adc_full_scale;
-    // Only one conversion in sequence, so only rank1
-    uint32_t ADCValue = HAL_ADCEx_InjectedGetValue(hadc, ADC_INJECTED_RANK_1);
-    vbus_voltage = ADCValue * voltage_scale;
+    // TIM1 triggers the conversion on every update event, i.e. twice per current measurement
+    static const float sample_period = CURRENT_MEAS_PERIOD / 2.0f;
+    // Average the conversions of the sequence
+    uint32_t ADCValue = 0;
+    for (uint32_t rank = 1; rank <= n_current_samples; ++rank)
+        ADCValue += HAL_ADCEx_InjectedGetValue(hadc, rank);
+    __HAL_ADC_CLEAR_FLAG(hadc, (ADC_FLAG_JSTRT | ADC_FLAG_JEOC));
+    vbus_voltage_instant = (float)ADCValue * (voltage_scale / (float)n_current_samples);
+
+    // The first sample initializes the filter
+    static bool filter_initialized = false;
+    float tau = board_config.dc_bus_voltage_filter_tau;
+    if (filter_initialized && tau > sample_period) {
+        vbus_voltage += (vbus_voltage_instant - vbus_voltage) * (sample_period / tau);
+    } else {
+        vbus_voltage = vbus_voltage_instant;
+        filter_initialized = true;
+    }
+
     if (axes[0] && !axes[0]->error_ && axes[1] && !axes[1]->error_) {
         if (oscilloscope_pos >= OSCILLOSCOPE_SIZE)
             oscilloscope_pos = 0;
-        oscilloscope[oscilloscope_pos++] = vbus_voltage;
+        oscilloscope[oscilloscope_pos++] = vbus_voltage_instant;
     }
 }
 
@@ -463,19 +616,49 @@ static void decode_hall_samples(Encoder& enc, uint16_t GPIO_samples[num_GPIO]) {
 }
 
 // This is the callback from the ADC that we expect after the PWM has triggered an ADC conversion.
+// ADC2 and ADC3 sample the phase B and C currents of a motor on the same trigger:
+//  - Motor 0 is on Timer 1, which triggers the injected groups.
+//  - Motor 1 is on Timer 8, which triggers the regular groups.
+// By default each ADC raises its own interrupt, and ADC2 is dispatched before
+// ADC3, which completes the measurement. With enable_simultaneous_adc only
+// ADC3 signals the end of a measurement and both results are read here:
+//  - For Motor 0, ADC1, ADC2 and ADC3 run in triple injected simultaneous
+//    mode, so ADC1 samples the bus voltage at the same instant.
+//  - For Motor 1, the results of the regular groups are copied by DMA, and
+//    the interrupt comes from the DMA stream of ADC3.
+// Each result is then the average of n_current_samples conversions.
 // TODO: Document how the phasing is done, link to timing diagram
 void pwm_trig_adc_cb(ADC_HandleTypeDef* hadc, bool injected) {
 #define calib_tau 0.2f  //@TOTO make more easily configurable
     static const float calib_filter_k = CURRENT_MEAS_PERIOD / calib_tau;
+    // Upper bound of the wait for the DMA transfer of ADC2, in polls. The
+    // transfer is a single half word that takes a few bus cycles.
+    static const uint32_t kAdc2DmaPolls = 32;
 
     // Ensure ADCs are expected ones to simplify the logic below
-    if (!(hadc == &hadc2 || hadc == &hadc3)) {
+    if (!(hadc == &hadc3 || (hadc == &hadc2 && !simultaneous_adc))) {
         low_level_fault(Motor::ERROR_ADC_FAILED);
         return;
     };
 
-    // Motor 0 is on Timer 1, which triggers ADC 2 and 3 on an injected conversion
-    // Motor 1 is on Timer 8, which triggers ADC 2 and 3 on a regular conversion
+    if (simultaneous_adc) {
+        // ADC2 converted on the same trigger and finished on the same cycle.
+        // Its DMA transfer may still be queued behind that of ADC3.
+        uint32_t ADC2_done;
+        if (injected) {
+            ADC2_done = __HAL_ADC_GET_FLAG(&hadc2, ADC_FLAG_JEOC);
+        } else {
+            uint32_t polls = kAdc2DmaPolls;
+            do {
+                ADC2_done = __HAL_DMA_GET_FLAG(&hdma_adc2, __HAL_DMA_GET_TC_FLAG_INDEX(&hdma_adc2));
+            } while (!ADC2_done && --polls);
+        }
+        if (!ADC2_done) {
+            low_level_fault(Motor::ERROR_ADC_FAILED);
+            return;
+        }
+    }
+
     // If the corresponding timer is counting up, we just sampled in SVM vector 0, i.e. real current
     // If we are counting down, we just sampled in SVM vector 7, with zero current
     Axis& axis = injected ? *axes[0] : *axes[1];
@@ -490,15 +673,11 @@ void pwm_trig_adc_cb(ADC_HandleTypeDef* hadc, bool injected) {
     else
         axis.motor_.log_timing(Motor::TIMING_LOG_ADC_CB_DC);
 
-    bool update_timings = false;
-    if (hadc == &hadc2) {
-        if (&axis == axes[1] && counting_down)
-            update_timings = true; // update timings of M0
-        else if (&axis == axes[0] && !counting_down)
-            update_timings = true; // update timings of M1
-    }
-
-    // Load next timings for the motor that we're not currently sampling
+    // Load next timings for the motor that we're not currently sampling, once
+    // per measurement: M0 is updated at the DC_CAL sample of M1, M1 at the
+    // current sample of M0
+    bool first_callback = simultaneous_adc || hadc == &hadc2;
+    bool update_timings = first_callback && ((&axis == axes[1]) ? counting_down : !counting_down);
     if (update_timings) {
         if (!other_axis.motor_.next_timings_valid_) {
             // the motor control loop failed to update the timings in time
@@ -516,28 +695,53 @@ void pwm_trig_adc_cb(ADC_HandleTypeDef* hadc, bool injected) {
         update_brake_current();
     }
 
-    uint32_t ADCValue;
-    if (injected) {
-        ADCValue = HAL_ADCEx_InjectedGetValue(hadc, ADC_INJECTED_RANK_1);
+    bool have_B = simultaneous_adc || hadc == &hadc2;
+    bool have_C = hadc == &hadc3;
+    uint32_t ADCValue_B = 0;
+    uint32_t ADCValue_C = 0;
+    if (!simultaneous_adc) {
+        uint32_t ADCValue = injected ? HAL_ADCEx_InjectedGetValue(hadc, ADC_INJECTED_RANK_1)
+                                     : HAL_ADC_GetValue(hadc);
+        if (have_B)
+            ADCValue_B = ADCValue;
+        else
+            ADCValue_C = ADCValue;
+    } else if (injected) {
+        // JDR1 ... JDR4 hold the results in the order of the sequence
+        const volatile uint32_t* JDR_B = &hadc2.Instance->JDR1;
+        const volatile uint32_t* JDR_C = &hadc3.Instance->JDR1;
+        for (uint32_t i = 0; i < n_current_samples; ++i) {
+            ADCValue_B += JDR_B[i];
+            ADCValue_C += JDR_C[i];
+        }
+        __HAL_ADC_CLEAR_FLAG(&hadc2, (ADC_FLAG_JSTRT | ADC_FLAG_JEOC));
+        vbus_sense_adc_cb(&hadc1, true);
     } else {
-        ADCValue = HAL_ADC_GetValue(hadc);
+        // DMA read DR, which clears EOC
+        for (uint32_t i = 0; i < n_current_samples; ++i) {
+            ADCValue_B += adc2_regular_samples_[i];
+            ADCValue_C += adc3_regular_samples_[i];
+        }
+        __HAL_DMA_CLEAR_FLAG(&hdma_adc2, __HAL_DMA_GET_TC_FLAG_INDEX(&hdma_adc2));
+        __HAL_ADC_CLEAR_FLAG(&hadc2, ADC_FLAG_STRT);
+        __HAL_ADC_CLEAR_FLAG(&hadc3, ADC_FLAG_STRT);
     }
-    float current = axis.motor_.phase_current_from_adcval(ADCValue);
+    float current_B = axis.motor_.phase_current_from_adcval((float)ADCValue_B / (float)n_current_samples);
+    float current_C = axis.motor_.phase_current_from_adcval((float)ADCValue_C / (float)n_current_samples);
 
     if (current_meas_not_DC_CAL) {
-        // ADC2 and ADC3 record the phB and phC currents concurrently,
-        // and their interrupts should arrive on the same clock cycle.
-        // We dispatch the callbacks in order, so ADC2 will always be processed before ADC3.
-        // Therefore we store the value from ADC2 and signal the thread that the
-        // measurement is ready when we receive the ADC3 measurement
-
-        // return or continue
-        if (hadc == &hadc2) {
-            axis.motor_.current_meas_.phB = current - axis.motor_.DC_calib_.phB;
+        if (have_B)
+            axis.motor_.current_meas_.phB = current_B - axis.motor_.DC_calib_.phB;
+        if (have_C)
+            axis.motor_.current_meas_.phC = current_C - axis.motor_.DC_calib_.phC;
+        // The measurement is complete with the result of ADC3
+        if (!have_C)
             return;
-        } else {
-            axis.motor_.current_meas_.phC = current - axis.motor_.DC_calib_.phC;
-        }
+        // Latch the bus voltage that goes with this current measurement.
+        // For M0 it was sampled on the same trigger. ADC1 has a single injected
+        // trigger (TIM1) and its regular group scans the GPIOs, so M1 gets the
+        // latest sample from TIM1, about 10us earlier.
+        axis.motor_.vbus_meas_ = vbus_voltage_instant;
         // Prepare hall readings
         // TODO move this to inside encoder update function
         decode_hall_samples(axis.encoder_, GPIO_port_samples[axis_num]);
@@ -545,11 +749,14 @@ void pwm_trig_adc_cb(ADC_HandleTypeDef* hadc, bool injected) {
         axis.signal_current_meas();
     } else {
         // DC_CAL measurement
-        if (hadc == &hadc2) {
-            axis.motor_.DC_calib_.phB += (current - axis.motor_.DC_calib_.phB) * calib_filter_k;
-        } else {
-            axis.motor_.DC_calib_.phC += (current - axis.motor_.DC_calib_.phC) * calib_filter_k;
-        }
+        // In overmodulation the high side FETs of phase B or C may not be on
+        // for long enough at the top of the PWM period to measure the offset
+        if (!axis.motor_.timings_dc_calib_valid_)
+            return;
+        if (have_B)
+            axis.motor_.DC_calib_.phB += (current_B - axis.motor_.DC_calib_.phB) * calib_filter_k;
+        if (have_C)
+            axis.motor_.DC_calib_.phC += (current_C - axis.motor_.DC_calib_.phC) * calib_filter_k;
     }
 }
 
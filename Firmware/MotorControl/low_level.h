@@ -18,12 +18,17 @@ extern "C" {
 /* Exported types ------------------------------------------------------------*/
 /* Exported constants --------------------------------------------------------*/
 #define ADC_CHANNEL_COUNT 16
+#define CURRENT_MEAS_MAX_OVERSAMPLING 4  // length of the injected sequence
 extern const float adc_full_scale;
 extern const float adc_ref_voltage;
 /* Exported variables --------------------------------------------------------*/
 extern float vbus_voltage;
+extern float vbus_voltage_instant;
 extern bool brake_resistor_armed;
 extern uint16_t adc_measurements_[ADC_CHANNEL_COUNT];
+extern float current_meas_delay;
+extern DMA_HandleTypeDef hdma_adc2;
+extern DMA_HandleTypeDef hdma_adc3;
 /* Exported macro ------------------------------------------------------------*/
 /* Exported functions --------------------------------------------------------*/
 
@@ -0,0 +1,117 @@
+
+#include <stdlib.h>
+#include "odrive_main.h"
+
+MotionTable::MotionTable(Config_t& config) :
+    config_(config)
+{
+    uint32_t size = config_.size;
+    if (size > kMaxSize)
+        size = kMaxSize;
+    if (size) {
+        table_ = (Point_t*)malloc(size * sizeof(Point_t));
+        table_size_ = table_ ? size : 0;
+    }
+}
+
+// @brief Writes one point of the table.
+// @returns false if the index is out of range or the table is being played back
+bool MotionTable::set_point(uint32_t index, float pos, float vel, float current) {
+    const Point_t point = { pos, vel, current };
+    return write_points(index, &point, 1);
+}
+
+// @brief Writes up to kBlockSize consecutive points starting at index.
+// Used to upload a table with fewer calls than set_point. Only the first
+// count points of the arguments are written.
+// @returns false if the points don't fit in the table or the table is being
+// played back
+bool MotionTable::set_points(uint32_t index, uint32_t count,
+        float pos0, float vel0, float current0,
+        float pos1, float vel1, float current1,
+        float pos2, float vel2, float current2,
+        float pos3, float vel3, float current3) {
+    if (count > kBlockSize)
+        return false;
+    const Point_t points[kBlockSize] = {
+        { pos0, vel0, current0 },
+        { pos1, vel1, current1 },
+        { pos2, vel2, current2 },
+        { pos3, vel3, current3 },
+    };
+    return write_points(index, points, count);
+}
+
+// Called from the communication thread. Playback is started by the control
+// loop, which can't run while interrupts are disabled, so checking playing_
+// and writing the points in one critical section keeps them from overlapping.
+bool MotionTable::write_points(uint32_t index, const Point_t* points, uint32_t count) {
+    if (index > table_size_ || count > table_size_ - index)
+        return false;
+    uint32_t prim = cpu_enter_critical();
+    bool ok = !playing_;
+    if (ok) {
+        for (uint32_t i = 0; i < count; ++i)
+            table_[index + i] = points[i];
+        if (count && index + count > length_)
+            length_ = index + count;
+    }
+    cpu_exit_critical(prim);
+    return ok;
+}
+
+// @brief Empties the table. Has no effect during playback.
+void MotionTable::clear() {
+    uint32_t prim = cpu_enter_critical();
+    if (!playing_)
+        length_ = 0;
+    cpu_exit_critical(prim);
+}
+
+// @brief Starts playback from the first point.
+// @param pos_setpoint: the current position setpoint, used as the origin of
+// a relative table
+// @returns false if the table is empty or the timing is invalid
+bool MotionTable::start(float pos_setpoint) {
+    if (length_ == 0 || !(config_.sample_time > 0.0f) || !(config_.time_scale > 0.0f))
+        return false;
+    t_ = 0.0f;
+    pos_offset_ = config_.relative ? pos_setpoint : 0.0f;
+    playing_ = true;
+    return true;
+}
+
+// @brief Advances by one control period and interpolates linearly between
+// the two neighbouring points.
+// The time scale stretches the table in time, so velocities are scaled by
+// time_scale and the (inertial) current feed-forward by time_scale^2.
+// @returns false once the end of the table is reached. The step then holds
+// the last position at zero velocity and current.
+bool MotionTable::update(Point_t* step) {
+    if (!playing_)
+        return false;
+
+    const float scale = config_.time_scale;
+    const float T = config_.sample_time;
+    const float T_end = (float)(length_ - 1) * T;
+    if (t_ >= T_end) {
+        playing_ = false;
+        *step = { table_[length_ - 1].pos + pos_offset_, 0.0f, 0.0f };
+        return false;
+    }
+
+    float idx_f = t_ / T;
+    uint32_t idx = (uint32_t)idx_f;
+    if (idx >= length_ - 1)
+        idx = length_ - 2;
+    float frac = idx_f - (float)idx;
+    const Point_t& p0 = table_[idx];
+    const Point_t& p1 = table_[idx + 1];
+
+    step->pos = p0.pos + frac * (p1.pos - p0.pos) + pos_offset_;
+    step->vel = (p0.vel + frac * (p1.vel - p0.vel)) * scale;
+    step->current = (p0.current + frac * (p1.current - p0.current)) * (scale * scale);
+
+    t_ += current_meas_period * scale;
+    return true;
+}
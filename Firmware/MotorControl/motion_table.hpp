@@ -0,0 +1,74 @@
+#ifndef __MOTION_TABLE_HPP
+#define __MOTION_TABLE_HPP
+
+#ifndef __ODRIVE_MAIN_H
+#error "This file should not be included directly. Include odrive_main.h instead."
+#endif
+
+// @brief Precomputed motion profile, sampled at a fixed interval, which is
+// uploaded in full and then played back at the control rate.
+// This is meant for profiles that are optimized offline, such as the output
+// of analysis/numeric_path_opt.
+class MotionTable {
+public:
+    struct Config_t {
+        uint32_t size = 0;           // number of points to allocate at startup, 0 to disable
+        float sample_time = 0.001f;  // [s] time between two points of the table
+        float time_scale = 1.0f;     // playback speed, 1.0f plays the table as designed
+        bool relative = true;        // positions are relative to the setpoint when playback starts
+    };
+
+    struct Point_t {
+        float pos;      // [counts]
+        float vel;      // [counts/s]
+        float current;  // [A] feed-forward
+    };
+
+    static constexpr uint32_t kMaxSize = 2048;
+    static constexpr uint32_t kBlockSize = 4; // points per set_points call
+
+    explicit MotionTable(Config_t& config);
+
+    bool set_point(uint32_t index, float pos, float vel, float current);
+    bool set_points(uint32_t index, uint32_t count,
+            float pos0, float vel0, float current0,
+            float pos1, float vel1, float current1,
+            float pos2, float vel2, float current2,
+            float pos3, float vel3, float current3);
+    void clear();
+    bool start(float pos_setpoint);
+    bool update(Point_t* step);
+
+    Config_t& config_;
+
+    Point_t* table_ = nullptr; // allocated once by the constructor
+    uint32_t table_size_ = 0;  // number of allocated points
+    uint32_t length_ = 0;      // number of valid points, i.e. highest index set + 1
+    bool playing_ = false;
+    float t_ = 0.0f;           // [s] position in the table, in table time
+    float pos_offset_ = 0.0f;  // [counts]
+
+    // Communication protocol definitions
+    auto make_protocol_definitions() {
+        return make_protocol_member_list(
+            make_protocol_ro_property("length", &length_),
+            make_protocol_ro_property("playing", &playing_),
+            make_protocol_object("config",
+                make_protocol_property("size", &config_.size),
+                make_protocol_property("sample_time", &config_.sample_time),
+                make_protocol_property("time_scale", &config_.time_scale),
+                make_protocol_property("relative", &config_.relative)
+            ),
+            make_protocol_function("set_point", *this, &MotionTable::set_point, "index", "pos", "vel", "current"),
+            make_protocol_function("set_points", *this, &MotionTable::set_points, "index", "count",
+                    "pos0", "vel0", "current0", "pos1", "vel1", "current1",
+                    "pos2", "vel2", "current2", "pos3", "vel3", "current3"),
+            make_protocol_function("clear", *this, &MotionTable::clear)
+        );
+    }
+
+private:
+    bool write_points(uint32_t index, const Point_t* points, uint32_t count);
+};
+
+#endif // __MOTION_TABLE_HPP
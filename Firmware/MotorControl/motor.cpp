@@ -17,7 +17,8 @@ Motor::Motor(const MotorHardwareConfig_t& hw_config,
             .EngpioNumber = gate_driver_config_.enable_pin,
             .nCSgpioHandle = gate_driver_config_.nCS_port,
             .nCSgpioNumber = gate_driver_config_.nCS_pin,
-        }) {
+        }),
+        thermal_model_(config.thermal_model) {
     update_current_controller_gains();
 }
 
@@ -36,6 +37,8 @@ bool Motor::arm() {
 
     // Reset controller states, integrators, setpoints, etc.
     axis_->controller_.reset();
+    if (axis_->controller_.error_ != Controller::ERROR_NONE)
+        return false;
     reset_current_control();
 
     // Wait until the interrupt handler triggers twice. This gives
@@ -50,6 +53,8 @@ bool Motor::arm() {
 void Motor::reset_current_control() {
     current_control_.v_current_control_integral_d = 0.0f;
     current_control_.v_current_control_integral_q = 0.0f;
+    current_control_.Id_setpoint = 0.0f;
+    field_weakening_Id_ = 0.0f;
 }
 
 // @brief Tune the current controller based on phase resistance and inductance
@@ -58,7 +63,7 @@ void Motor::reset_current_control() {
 void Motor::update_current_controller_gains() {
     // Calculate current control gains
     current_control_.p_gain = config_.current_control_bandwidth * config_.phase_inductance;
-    float plant_pole = config_.phase_resistance / config_.phase_inductance;
+    float plant_pole = phase_resistance() / config_.phase_inductance;
     current_control_.i_gain = plant_pole * current_control_.p_gain;
 }
 
@@ -154,6 +159,22 @@ bool Motor::update_thermal_limits() {
     float temp_margin = config_.inverter_temp_limit_upper - fet_temp;
     float derating_range = config_.inverter_temp_limit_upper - config_.inverter_temp_limit_lower;
     thermal_current_lim_ = config_.current_lim * (temp_margin / derating_range);
+    if (config_.enable_resistance_estimation && phase_resistance_est_ > 0.0f) {
+        float winding_margin = config_.winding_temp_limit_upper - winding_temp_est_;
+        float winding_range = config_.winding_temp_limit_upper - config_.winding_temp_limit_lower;
+        thermal_current_lim_ = std::min(thermal_current_lim_, config_.current_lim * (winding_margin / winding_range));
+    }
+    if (config_.thermal_model.enabled) {
+        float I_sq = 0.0f;
+        if (armed_state_ == ARMED_STATE_ARMED)
+            I_sq = last_Id_ * last_Id_ + last_Iq_ * last_Iq_;
+        // The online estimate is the resistance at the estimated winding temperature
+        if (config_.enable_resistance_estimation && phase_resistance_est_ > 0.0f)
+            thermal_model_.update(I_sq, phase_resistance_est_, winding_temp_est_);
+        else
+            thermal_model_.update(I_sq, config_.phase_resistance, config_.resistance_calib_temp);
+        thermal_current_lim_ = std::min(thermal_current_lim_, thermal_model_.current_lim_);
+    }
     if (!(thermal_current_lim_ >= 0.0f)) { //Funny polarity to also catch NaN
         thermal_current_lim_ = 0.0f;
     }
@@ -176,7 +197,8 @@ bool Motor::do_checks() {
     return true;
 }
 
-float Motor::effective_current_lim() {
+// @brief Limit on the magnitude of the total (Id, Iq) current vector
+float Motor::total_current_lim() {
     // Configured limit
     float current_lim = config_.current_lim;
     // Hardware limit
@@ -187,6 +209,24 @@ float Motor::effective_current_lim() {
     }
     // Thermal limit
     current_lim = std::min(current_lim, thermal_current_lim_);
+    return current_lim;
+}
+
+// @brief Limit on the current setpoint, i.e. the share of the total current
+// limit that Id leaves to Iq
+float Motor::effective_current_lim() {
+    float current_lim = total_current_lim();
+    // Id takes its share of the total current. The Id of the last cycle is
+    // the field weakening and the MTPA Id, which are both negative, plus the
+    // resistance estimation injection, which is counted at its full amplitude
+    // so that the Iq budget doesn't toggle with its sign. The current setpoint
+    // is no less than the MTPA Iq, so limiting it to the rest is conservative.
+    float Id = fabsf(field_weakening_Id_) + fabsf(resistance_est_Id_);
+    if (config_.enable_mtpa)
+        Id += fabsf(mtpa_Id_);
+    if (Id != 0.0f) {
+        current_lim = sqrtf(std::max(current_lim * current_lim - Id * Id, 0.0f));
+    }
 
     return current_lim;
 }
@@ -200,9 +240,9 @@ void Motor::log_timing(TimingLog_t log_idx) {
     }
 }
 
-float Motor::phase_current_from_adcval(uint32_t ADCValue) {
-    int adcval_bal = (int)ADCValue - (1 << 11);
-    float amp_out_volt = (3.3f / (float)(1 << 12)) * (float)adcval_bal;
+float Motor::phase_current_from_adcval(float ADCValue) {
+    float adcval_bal = ADCValue - (float)(1 << 11);
+    float amp_out_volt = (3.3f / (float)(1 << 12)) * adcval_bal;
     float shunt_volt = amp_out_volt * phase_current_rev_gain_;
     float current = shunt_volt * hw_config_.shunt_conductance;
     return current;
@@ -212,13 +252,43 @@ float Motor::phase_current_from_adcval(uint32_t ADCValue) {
 // Measurement and calibration
 //--------------------------------
 
+// The resistance and inductance measurements average over windows of
+// kCalibrationWindow cycles and stop as soon as the estimate is within
+// config_.calibration_accuracy, or after config_.calibration_timeout.
+// They run for at least kMinCalibrationWindows windows.
+static const uint32_t kCalibrationWindow = 2 * static_cast<uint32_t>(0.025f * CURRENT_MEAS_HZ); // [cycles] 50ms, even
+static const uint32_t kMinCalibrationWindows = 3;
+
+// The measurements used to run for a fixed 3s (resistance) and 10000 cycles
+// (inductance), which the timeout doesn't undercut
+static const uint32_t kMinResistanceCycles = static_cast<uint32_t>(3.0f * CURRENT_MEAS_HZ);
+static const uint32_t kMinInductanceCycles = 10000;
+
+static uint32_t calibration_cycles(float timeout, uint32_t min_cycles) {
+    uint32_t cycles = static_cast<uint32_t>(timeout / CURRENT_MEAS_PERIOD);
+    return std::max(cycles, std::max(min_cycles, kMinCalibrationWindows * kCalibrationWindow));
+}
+
+// @brief Drives test_current along phase A and returns the voltage this takes.
+// The voltage is integrated from the current error, so it settles with a
+// time constant of R / kI. The measurement has converged when the average
+// current of a window is within the accuracy of test_current and the average
+// voltage changed by less than that since the previous window.
+// @param rel_error: the larger of both relative deviations in the last window
+// @returns false with ERROR_CALIBRATION_TIMEOUT if it doesn't converge in time
 // TODO check Ibeta balance to verify good motor connection
-bool Motor::measure_phase_resistance(float test_current, float max_voltage) {
+bool Motor::measure_resistance_voltage(float test_current, float max_voltage, float* result, float* rel_error) {
     static const float kI = 10.0f;                                 // [(V/s)/A]
-    static const int num_test_cycles = static_cast<int>(3.0f / CURRENT_MEAS_PERIOD); // Test runs for 3s
+    const uint32_t max_cycles = calibration_cycles(config_.calibration_timeout, kMinResistanceCycles);
     float test_voltage = 0.0f;
-    
-    size_t i = 0;
+    float V_sum = 0.0f;
+    float I_sum = 0.0f;
+    float V_window = 0.0f;
+    float V_prev_window = 0.0f;
+    *rel_error = INFINITY;
+    bool converged = false;
+
+    uint32_t i = 0;
     axis_->run_control_loop([&](){
         float Ialpha = -(current_meas_.phB + current_meas_.phC);
         test_voltage += (kI * current_meas_period) * (test_current - Ialpha);
@@ -230,7 +300,21 @@ bool Motor::measure_phase_resistance(float test_current, float max_voltage) {
             return false; // error set inside enqueue_voltage_timings
         log_timing(TIMING_LOG_MEAS_R);
 
-        return ++i < num_test_cycles;
+        V_sum += test_voltage;
+        I_sum += Ialpha;
+        if (++i % kCalibrationWindow == 0) {
+            V_prev_window = V_window;
+            V_window = V_sum / (float)kCalibrationWindow;
+            float I_window = I_sum / (float)kCalibrationWindow;
+            V_sum = 0.0f;
+            I_sum = 0.0f;
+            float I_error = fabsf(I_window - test_current) / fabsf(test_current);
+            float V_error = fabsf(V_window - V_prev_window) / fabsf(V_window);
+            *rel_error = std::max(I_error, V_error);
+            if (i >= kMinCalibrationWindows * kCalibrationWindow && *rel_error < config_.calibration_accuracy)
+                return converged = true, false;
+        }
+        return i < max_cycles;
     });
     if (axis_->error_ != Axis::ERROR_NONE)
         return false;
@@ -239,27 +323,95 @@ bool Motor::measure_phase_resistance(float test_current, float max_voltage) {
     //if (!enqueue_voltage_timings(motor, 0.0f, 0.0f))
     //    return false; // error set inside enqueue_voltage_timings
 
+    if (!converged)
+        return set_error(ERROR_CALIBRATION_TIMEOUT), false;
+
+    *result = V_window;
+    return true;
+}
+
+bool Motor::measure_phase_resistance(float test_current, float max_voltage) {
+    float test_voltage;
+    if (!measure_resistance_voltage(test_current, max_voltage, &test_voltage, &phase_resistance_rel_error_))
+        return false;
     float R = test_voltage / test_current;
     config_.phase_resistance = R;
-    return true; // if we ran to completion that means success
+    return true;
 }
 
-bool Motor::measure_phase_inductance(float voltage_low, float voltage_high) {
-    float test_voltages[2] = {voltage_low, voltage_high};
-    float Ialphas[2] = {0.0f};
-    static const int num_cycles = 5000;
+// @brief Identifies the voltage error of the inverter together with the
+// resistance. During the dead time the phase voltage is set by the current
+// direction rather than the gate signals, and the FETs and diodes drop some
+// voltage, so the applied voltage is
+//   V = R * I + 4/3 * dead_time_voltage
+// with phase A carrying I and phases B and C -I/2 each. The test voltage is
+// measured at two currents and the line fit gives both.
+bool Motor::measure_dead_time_voltage(float test_current, float max_voltage) {
+    float V_high, V_low;
+    float err_high, err_low;
+    float I_high = test_current;
+    float I_low = 0.5f * test_current;
+    if (!measure_resistance_voltage(I_high, max_voltage, &V_high, &err_high))
+        return false;
+    if (!measure_resistance_voltage(I_low, max_voltage, &V_low, &err_low))
+        return false;
+    float R = (V_high - V_low) / (I_high - I_low);
+    float V_offset = V_high - R * I_high;
+    config_.phase_resistance = R;
+    config_.dead_time_voltage = std::max(0.75f * V_offset, 0.0f);
+    // The errors of both voltages add up in their difference
+    phase_resistance_rel_error_ = (err_high * fabsf(V_high) + err_low * fabsf(V_low)) / fabsf(V_high - V_low);
+    return true;
+}
 
-    size_t t = 0;
+// @brief Measures the inductance along the direction (dir_alpha, dir_beta)
+// of the stationary frame, by toggling the voltage in that direction and
+// observing the current ramp.
+// The current ramp is computed for each window, and the measurement has
+// converged when the standard error of their mean is within the accuracy.
+// @param rel_error: the relative standard error of the result
+// @returns false with ERROR_CALIBRATION_TIMEOUT if it doesn't converge in time
+bool Motor::measure_inductance(float voltage_low, float voltage_high, float dir_alpha, float dir_beta, float* L, float* rel_error) {
+    float test_voltages[2] = {voltage_low, voltage_high};
+    float Itests[2] = {0.0f};
+    const uint32_t max_cycles = calibration_cycles(config_.calibration_timeout, kMinInductanceCycles);
+    // Running mean and sum of squared deviations of the windows' dI/dt
+    uint32_t num_windows = 0;
+    float dI_by_dt_mean = 0.0f;
+    float dI_by_dt_M2 = 0.0f;
+    *rel_error = INFINITY;
+    bool converged = false;
+
+    uint32_t t = 0;
     axis_->run_control_loop([&](){
         int i = t & 1;
-        Ialphas[i] += -current_meas_.phB - current_meas_.phC;
+        float Ialpha = -current_meas_.phB - current_meas_.phC;
+        float Ibeta = one_by_sqrt3 * (current_meas_.phB - current_meas_.phC);
+        Itests[i] += dir_alpha * Ialpha + dir_beta * Ibeta;
 
-        // Test voltage along phase A
-        if (!enqueue_voltage_timings(test_voltages[i], 0.0f))
+        // Test voltage along the test direction
+        if (!enqueue_voltage_timings(dir_alpha * test_voltages[i], dir_beta * test_voltages[i]))
             return false; // error set inside enqueue_voltage_timings
         log_timing(TIMING_LOG_MEAS_L);
 
-        return ++t < (num_cycles << 1);
+        if (++t % kCalibrationWindow == 0) {
+            // Note: A more correct formula would also take into account that there is a finite timestep.
+            // However, the discretisation in the current control loop inverts the same discrepancy
+            float dI_by_dt = (Itests[1] - Itests[0]) / (current_meas_period * (float)(kCalibrationWindow / 2));
+            Itests[0] = 0.0f;
+            Itests[1] = 0.0f;
+            ++num_windows;
+            float delta = dI_by_dt - dI_by_dt_mean;
+            dI_by_dt_mean += delta / (float)num_windows;
+            dI_by_dt_M2 += delta * (dI_by_dt - dI_by_dt_mean);
+            if (num_windows >= kMinCalibrationWindows) {
+                float std_error = sqrtf(dI_by_dt_M2 / (float)((num_windows - 1) * num_windows));
+                *rel_error = std_error / fabsf(dI_by_dt_mean);
+                if (*rel_error < config_.calibration_accuracy)
+                    return converged = true, false;
+            }
+        }
+        return t < max_cycles;
     });
     if (axis_->error_ != Axis::ERROR_NONE)
         return false;
@@ -268,43 +420,348 @@ bool Motor::measure_phase_inductance(float voltage_low, float voltage_high) {
     //if (!enqueue_voltage_timings(motor, 0.0f, 0.0f))
     //    return false; // error set inside enqueue_voltage_timings
 
+    if (!converged)
+        return set_error(ERROR_CALIBRATION_TIMEOUT), false;
+
     float v_L = 0.5f * (voltage_high - voltage_low);
-    // Note: A more correct formula would also take into account that there is a finite timestep.
-    // However, the discretisation in the current control loop inverts the same discrepancy
-    float dI_by_dt = (Ialphas[1] - Ialphas[0]) / (current_meas_period * (float)num_cycles);
-    float L = v_L / dI_by_dt;
+    *L = v_L / dI_by_dt_mean;
 
-    config_.phase_inductance = L;
     // TODO arbitrary values set for now
-    if (L < 2e-6f || L > 4000e-6f)
+    if (*L < 2e-6f || *L > 4000e-6f)
         return set_error(ERROR_PHASE_INDUCTANCE_OUT_OF_RANGE), false;
     return true;
 }
 
+bool Motor::measure_phase_inductance(float voltage_low, float voltage_high) {
+    // Test voltage along phase A
+    return measure_inductance(voltage_low, voltage_high, 1.0f, 0.0f, &config_.phase_inductance, &phase_inductance_rel_error_);
+}
+
+// @brief Measures the d and q axis inductances of a salient motor.
+// This relies on the rotor having been pulled into alignment with phase A
+// by measure_phase_resistance, so the motor must be free to move and
+// unloaded. The d axis is then along alpha and the q axis along beta.
+bool Motor::measure_dq_inductance(float voltage_low, float voltage_high) {
+    float err_d, err_q;
+    if (!measure_inductance(voltage_low, voltage_high, 1.0f, 0.0f, &config_.phase_inductance_d, &err_d))
+        return false;
+    if (!measure_inductance(voltage_low, voltage_high, 0.0f, 1.0f, &config_.phase_inductance_q, &err_q))
+        return false;
+    phase_inductance_rel_error_ = std::max(phase_inductance_rel_error_, std::max(err_d, err_q));
+    return true;
+}
+
+// @brief Identifies the permanent magnet flux linkage by spinning the motor
+// open loop with calibration_current, at a few speeds up to
+// flux_linkage_calib_vel. In steady state the back-EMF in the frame of the
+// current vector is
+//   e_dq = V_dq - R * I_dq - j * omega * L * I_dq
+// and its magnitude is omega * flux_linkage, however far the rotor lags.
+// The slope of a line fit of |e| over omega gives the flux linkage, and the
+// offset takes up errors of R and of the inverter voltage.
+// The motor must be free to spin. The result goes to the sensorless
+// estimator config, and the torque constant follows from it.
+// See analysis/current_control/flux_linkage_sim.py for a simulation.
+bool Motor::measure_flux_linkage() {
+    static const int kNumPoints = 4;
+    static const float kAlignTime = 0.4f;    // [s]
+    static const float kSettleTime = 0.2f;   // [s]
+    static const float kMeasureTime = 0.3f;  // [s]
+    const uint32_t settle_cycles = static_cast<uint32_t>(kSettleTime / current_meas_period);
+    const uint32_t measure_cycles = static_cast<uint32_t>(kMeasureTime / current_meas_period);
+
+    const float I = config_.calibration_current;
+    const float R = config_.phase_resistance;
+    const float L = config_.phase_inductance;
+    const float max_vel_step = config_.flux_linkage_calib_accel * current_meas_period;
+    float phase = 0.0f;
+    float vel = 0.0f;
+    float target_vel = 0.0f;
+    bool saturated = false;
+
+    // Runs one control cycle at vel, ramping it towards target_vel
+    auto spin = [&]() {
+        float vel_error = target_vel - vel;
+        if (fabsf(vel_error) <= max_vel_step)
+            vel = target_vel;
+        else
+            vel += (vel_error > 0.0f) ? max_vel_step : -max_vel_step;
+        phase = wrap_pm_pi(phase + vel * current_meas_period);
+        float pwm_phase = phase + 1.5f * current_meas_period * vel;
+        if (!FOC_current(0.0f, I, phase, pwm_phase, vel))
+            return false;
+        saturated = saturated || current_control_.mod_demand_ratio > 1.0f;
+        return !saturated;
+    };
+
+    // Pull the rotor into alignment
+    float x = 0.0f;
+    axis_->run_control_loop([&](){
+        x += current_meas_period / kAlignTime;
+        if (!FOC_current(0.0f, I * std::min(x, 1.0f), 0.0f, 0.0f, 0.0f))
+            return false;
+        return x < 1.0f;
+    });
+
+    float omegas[kNumPoints];
+    float emfs[kNumPoints];
+    int num_points = 0;
+    for (; num_points < kNumPoints && axis_->error_ == Axis::ERROR_NONE && !saturated; ++num_points) {
+        target_vel = config_.flux_linkage_calib_vel * (float)(num_points + 1) / (float)kNumPoints;
+        float e_d_sum = 0.0f;
+        float e_q_sum = 0.0f;
+        uint32_t i = 0;
+        axis_->run_control_loop([&](){
+            if (!spin())
+                return false;
+            if (vel != target_vel)
+                return true;
+            if (++i <= settle_cycles)
+                return true;
+
+            // Applied voltage in the frame of the current vector
+            float c = our_arm_cos_f32(phase + 1.5f * current_meas_period * vel);
+            float s = our_arm_sin_f32(phase + 1.5f * current_meas_period * vel);
+            float Vd = c * current_control_.final_v_alpha + s * current_control_.final_v_beta;
+            float Vq = c * current_control_.final_v_beta - s * current_control_.final_v_alpha;
+            e_d_sum += Vd - R * last_Id_ + vel * L * last_Iq_;
+            e_q_sum += Vq - R * last_Iq_ - vel * L * last_Id_;
+            return i < settle_cycles + measure_cycles;
+        });
+        if (i < settle_cycles + measure_cycles)
+            break; // saturated or failed before the point was complete
+        omegas[num_points] = target_vel;
+        emfs[num_points] = sqrtf(e_d_sum * e_d_sum + e_q_sum * e_q_sum) / (float)measure_cycles;
+    }
+
+    // Slow down again before letting go of the rotor
+    saturated = false;
+    target_vel = 0.0f;
+    axis_->run_control_loop([&](){
+        if (!spin() && !saturated)
+            return false;
+        return vel != 0.0f;
+    });
+    if (axis_->error_ != Axis::ERROR_NONE)
+        return false;
+
+    // Least squares fit of emf = flux_linkage * omega + offset
+    if (num_points < 2)
+        return set_error(ERROR_FLUX_LINKAGE_OUT_OF_RANGE), false;
+    float omega_mean = 0.0f;
+    float emf_mean = 0.0f;
+    for (int k = 0; k < num_points; ++k) {
+        omega_mean += omegas[k] / (float)num_points;
+        emf_mean += emfs[k] / (float)num_points;
+    }
+    float cov = 0.0f;
+    float var = 0.0f;
+    for (int k = 0; k < num_points; ++k) {
+        cov += (omegas[k] - omega_mean) * (emfs[k] - emf_mean);
+        var += (omegas[k] - omega_mean) * (omegas[k] - omega_mean);
+    }
+    float flux_linkage = cov / var;
+    if (!(flux_linkage > 0.0f))
+        return set_error(ERROR_FLUX_LINKAGE_OUT_OF_RANGE), false;
+
+    axis_->sensorless_estimator_.config_.pm_flux_linkage = flux_linkage;
+    config_.torque_constant = 1.5f * (float)config_.pole_pairs * flux_linkage;
+    return true;
+}
+
+/*
+ * Maximum torque per amp for salient (interior permanent magnet) motors.
+ * The torque is proportional to
+ *   Iq * (flux_linkage + (Ld - Lq) * Id)
+ * and for a given current magnitude it is highest on the curve
+ *   Id = a - sqrt(a^2 + Iq^2),  a = flux_linkage / (2 * (Lq - Ld))
+ * The current command is treated as the q current that would produce the
+ * requested torque without saliency, so it keeps the meaning of
+ * torque_constant * current. The Iq on the MTPA curve which gives the same
+ * torque is the fixed point of
+ *   Iq = flux_linkage * current_setpoint / (flux_linkage - (Lq - Ld) * Id(Iq))
+ * which contracts, so warm starting from the previous tick needs only a
+ * couple of iterations.
+ */
+void Motor::mtpa_current_split(float current_setpoint, float* Id, float* Iq) {
+    float flux_linkage = axis_->sensorless_estimator_.config_.pm_flux_linkage;
+    float delta_L = config_.phase_inductance_q - config_.phase_inductance_d;
+    if (!(delta_L > 0.0f) || !(flux_linkage > 0.0f)) {
+        mtpa_Id_ = 0.0f;
+        *Id = 0.0f;
+        *Iq = current_setpoint;
+        return;
+    }
+    float a = flux_linkage / (2.0f * delta_L);
+    float Iq_mtpa = (mtpa_Iq_ * current_setpoint > 0.0f) ? mtpa_Iq_ : current_setpoint;
+    float Id_mtpa = 0.0f;
+    for (int i = 0; i < 2; ++i) {
+        // Same as a - sqrt(a^2 + Iq^2), without the cancellation
+        Id_mtpa = -(Iq_mtpa * Iq_mtpa) / (a + sqrtf(a * a + Iq_mtpa * Iq_mtpa));
+        Iq_mtpa = flux_linkage * current_setpoint / (flux_linkage - delta_L * Id_mtpa);
+    }
+    mtpa_Iq_ = Iq_mtpa;
+    mtpa_Id_ = -(Iq_mtpa * Iq_mtpa) / (a + sqrtf(a * a + Iq_mtpa * Iq_mtpa));
+    *Id = mtpa_Id_;
+    *Iq = Iq_mtpa;
+}
+
 
 bool Motor::run_calibration() {
     float R_calib_max_voltage = config_.resistance_calib_max_voltage;
     if (config_.motor_type == MOTOR_TYPE_HIGH_CURRENT) {
-        if (!measure_phase_resistance(config_.calibration_current, R_calib_max_voltage))
-            return false;
+        if (config_.enable_dead_time_compensation) {
+            if (!measure_dead_time_voltage(config_.calibration_current, R_calib_max_voltage))
+                return false;
+        } else {
+            if (!measure_phase_resistance(config_.calibration_current, R_calib_max_voltage))
+                return false;
+        }
         if (!measure_phase_inductance(-R_calib_max_voltage, R_calib_max_voltage))
             return false;
+        if (config_.enable_mtpa && !measure_dq_inductance(-R_calib_max_voltage, R_calib_max_voltage))
+            return false;
     } else if (config_.motor_type == MOTOR_TYPE_GIMBAL) {
         // no calibration needed
     } else {
         return false;
     }
 
+    // A new measurement restarts the online estimate
+    phase_resistance_est_ = 0.0f;
     update_current_controller_gains();
     
     is_calibrated_ = true;
     return true;
 }
 
+// Overmodulation compensation, from the requested fundamental to the scale
+// of region I and the vertex hold angle of region II.
+// Generated by analysis/current_control/modulation_sim.py
+static const float kSixStepFundamental = 0.95493f;  // 3/pi
+static const float kHexagonFundamental = 0.90855f;  // fundamental of following the hexagon
+static const size_t kOvermodTableSize = 9;
+static const float kOvermodScale[kOvermodTableSize] = {
+    0.86603f, 0.87230f, 0.87976f, 0.88841f, 0.89851f, 0.91055f, 0.92554f, 0.94611f, 1.00000f
+};
+static const float kOvermodHoldAngle[kOvermodTableSize] = {
+    0.00000f, 0.03426f, 0.07096f, 0.11077f, 0.15468f, 0.20438f, 0.26319f, 0.33963f, 0.52360f
+};
+
+static float overmod_table_lookup(const float* table, float x) {
+    float idx_f = std::max(0.0f, std::min(x, 1.0f)) * (float)(kOvermodTableSize - 1);
+    size_t idx = std::min((size_t)idx_f, kOvermodTableSize - 2);
+    float frac = idx_f - (float)idx;
+    return table[idx] + frac * (table[idx + 1] - table[idx]);
+}
+
+// @brief Scales a modulation vector back onto the SVM hexagon if it lies
+// outside. The edges are sqrt(3)/2 from the center, at 30, 90 and 150 degrees.
+// A small margin keeps rounding from tripping the SVM range check.
+static void clip_to_hexagon(float* mod_alpha, float* mod_beta) {
+    static const float kEdge = 0.9999f * sqrt3_by_2;
+    float edge_dist = std::max(fabsf(*mod_beta), std::max(fabsf(sqrt3_by_2 * *mod_alpha + 0.5f * *mod_beta),
+                                                          fabsf(sqrt3_by_2 * *mod_alpha - 0.5f * *mod_beta)));
+    if (edge_dist > kEdge) {
+        *mod_alpha *= kEdge / edge_dist;
+        *mod_beta *= kEdge / edge_dist;
+    }
+}
+
+// @brief Turns a modulation vector with a magnitude between the linear limit
+// (sqrt(3)/2) and six-step (3/pi) into one the inverter can produce, such
+// that the fundamental over an electrical revolution has the requested
+// magnitude.
+// Region I scales the vector up and clips it to the hexagon. Region II
+// also holds it at the nearest vertex for a growing angle, and ends in
+// six-step when the vector always sits on a vertex.
+static void overmodulate(float* mod_alpha, float* mod_beta, float magnitude) {
+    float alpha, beta;
+    if (magnitude <= kHexagonFundamental) {
+        float scale = overmod_table_lookup(kOvermodScale,
+                (magnitude - sqrt3_by_2) / (kHexagonFundamental - sqrt3_by_2));
+        alpha = *mod_alpha * (scale / magnitude);
+        beta = *mod_beta * (scale / magnitude);
+        clip_to_hexagon(&alpha, &beta);
+    } else {
+        float hold_angle = overmod_table_lookup(kOvermodHoldAngle,
+                (magnitude - kHexagonFundamental) / (kSixStepFundamental - kHexagonFundamental));
+        float theta = fast_atan2(*mod_beta, *mod_alpha);
+        float vertex = floorf(theta * (3.0f / M_PI) + 0.5f) * (M_PI / 3.0f);
+        float d = theta - vertex;
+        float m = 1.0f;
+        if (fabsf(d) > hold_angle) {
+            // Travel along the hexagon edge in the remaining angle
+            d = copysignf((fabsf(d) - hold_angle) * ((M_PI / 6.0f) / (M_PI / 6.0f - hold_angle)), d);
+            m = sqrt3_by_2 / our_arm_cos_f32(M_PI / 6.0f - fabsf(d));
+        } else {
+            d = 0.0f;
+        }
+        alpha = m * our_arm_cos_f32(vertex + d);
+        beta = m * our_arm_sin_f32(vertex + d);
+    }
+    // Stay just inside the hexagon, so that rounding doesn't trip the SVM range check
+    *mod_alpha = 0.9999f * alpha;
+    *mod_beta = 0.9999f * beta;
+}
+
+// @brief The largest magnitude of the modulation fundamental that the current
+// controller may request in the configured modulation mode.
+// After max_stale_current_samples cycles in a row without a valid current
+// sample, the limited linear range, which always leaves a sampling window,
+// is used until the next valid sample, so the loop never runs open for long.
+float Motor::max_modulation() {
+    if (stale_current_samples_ >= config_.max_stale_current_samples)
+        return 0.80f * sqrt3_by_2;
+    switch (config_.modulation_mode) {
+        case MODULATION_MODE_LINEAR: return sqrt3_by_2;
+        case MODULATION_MODE_OVERMODULATION: return kSixStepFundamental;
+        default: return 0.80f * sqrt3_by_2;
+    }
+}
+
+// @brief The bus voltage used to convert voltages to modulation.
+// The bus voltage ripples with the load current on long supply leads, and
+// the applied voltage ripples with it unless the modulation is scaled by the
+// instantaneous value (see analysis/current_control/vbus_ripple_sim.py).
+float Motor::modulation_vbus() {
+    return config_.enable_vbus_compensation ? vbus_meas_ : vbus_voltage;
+}
+
+// @brief The phase currents are sampled on phases B and C at the bottom of
+// the PWM period, while all low side FETs are on (V0), and their DC offset
+// at the top while all high side FETs are on (V7). Near the edge of the
+// hexagon the zero vector time becomes short, so it is moved from V7 to V0
+// as far as needed to keep current_sample_window for the current sample.
+// Shifting all timings by the same amount doesn't change the line voltages.
+// Whether a valid current and DC calibration sample can be taken with the
+// timings is recorded for FOC_current and the ADC callback.
+// With oversampling, the last conversion is 2 * current_meas_delay later.
+void Motor::apply_sample_window(float* tA, float* tB, float* tC) {
+    float window = (config_.current_sample_window + 2.0f * current_meas_delay)
+                 * ((float)TIM_1_8_CLOCK_HZ / (float)TIM_1_8_PERIOD_CLOCKS);
+    float t_min = std::min(*tB, *tC);
+    float t_max = std::max(*tA, std::max(*tB, *tC));
+    if (t_min < window) {
+        float shift = std::min(window - t_min, 1.0f - t_max);
+        *tA += shift;
+        *tB += shift;
+        *tC += shift;
+    }
+    timings_sample_valid_ = std::min(*tB, *tC) >= window;
+    timings_dc_calib_valid_ = std::max(*tB, *tC) <= 1.0f - window;
+}
+
 bool Motor::enqueue_modulation_timings(float mod_alpha, float mod_beta) {
     float tA, tB, tC;
     if (SVM(mod_alpha, mod_beta, &tA, &tB, &tC) != 0)
         return set_error(ERROR_MODULATION_MAGNITUDE), false;
+    if (config_.modulation_mode != MODULATION_MODE_LINEAR_LIMITED) {
+        apply_sample_window(&tA, &tB, &tC);
+    } else {
+        timings_sample_valid_ = true;
+        timings_dc_calib_valid_ = true;
+    }
     next_timings_[0] = (uint16_t)(tA * (float)TIM_1_8_PERIOD_CLOCKS);
     next_timings_[1] = (uint16_t)(tB * (float)TIM_1_8_PERIOD_CLOCKS);
     next_timings_[2] = (uint16_t)(tC * (float)TIM_1_8_PERIOD_CLOCKS);
@@ -313,7 +770,7 @@ bool Motor::enqueue_modulation_timings(float mod_alpha, float mod_beta) {
 }
 
 bool Motor::enqueue_voltage_timings(float v_alpha, float v_beta) {
-    float vfactor = 1.0f / ((2.0f / 3.0f) * vbus_voltage);
+    float vfactor = 1.0f / ((2.0f / 3.0f) * modulation_vbus());
     float mod_alpha = vfactor * v_alpha;
     float mod_beta = vfactor * v_beta;
     if (!enqueue_modulation_timings(mod_alpha, mod_beta))
@@ -331,16 +788,117 @@ bool Motor::FOC_voltage(float v_d, float v_q, float pwm_phase) {
     return enqueue_voltage_timings(v_alpha, v_beta);
 }
 
-bool Motor::FOC_current(float Id_des, float Iq_des, float I_phase, float pwm_phase) {
+// @brief Field weakening: above base speed the back-EMF approaches the bus
+// voltage and the current controller runs out of modulation. An integrator
+// on the modulation demand then injects negative Id, which counteracts the
+// magnet flux and lets the motor run faster, and backs off again when
+// there is headroom. effective_current_lim() gives the remaining share of
+// the total current, after all Id components, to Iq.
+// @returns the field weakening Id [A]
+float Motor::update_field_weakening() {
+    if (!config_.enable_field_weakening) {
+        field_weakening_Id_ = 0.0f;
+        return 0.0f;
+    }
+    float mod_excess = current_control_.mod_demand_ratio - config_.field_weakening_modulation;
+    float Id = field_weakening_Id_ - (config_.field_weakening_gain * current_meas_period) * mod_excess;
+    float Id_max = std::min(config_.field_weakening_max_current, total_current_lim());
+    Id = std::max(-Id_max, std::min(Id, 0.0f));
+    field_weakening_Id_ = Id;
+    return Id;
+}
+
+// @brief The winding resistance: the online estimate if it is enabled and
+// has started, the calibrated value otherwise.
+float Motor::phase_resistance() {
+    if (config_.enable_resistance_estimation && phase_resistance_est_ > 0.0f)
+        return phase_resistance_est_;
+    return config_.phase_resistance;
+}
+
+// @brief Online winding resistance estimation. A square wave of
+// +/-resistance_est_injection_current is added to Id, and in steady state
+// the d axis voltage is
+//   Vd = R * Id - omega * Lq * Iq + offsets
+// Correlating Vd and Id with the sign of the injection over a full period
+// cancels everything that doesn't follow the injection, so the ratio of both
+// sums is R. The first half of each half period is skipped, so that the
+// L * dId/dt transient after a toggle doesn't enter. Periods in which the
+// modulation saturated are discarded.
+// The winding temperature follows from the tempco of copper.
+// Changes of speed and load within a period add noise, which the low pass
+// filter with resistance_est_tau averages out.
+// The dead time voltage points along the current, so it follows the sign of
+// the injection and, uncompensated, adds about dead_time_voltage / |I| to
+// the estimate. The estimation therefore requires the dead time compensation,
+// and holds (without injecting) while the load current is within twice
+// dead_time_current_band, where the compensation is only partial.
+// @returns the Id injection for this cycle [A]
+float Motor::update_resistance_estimation() {
+    static const float kCopperTempco = 0.00393f; // [1/degC]
+    bool dead_time_compensated = config_.enable_dead_time_compensation && config_.dead_time_voltage > 0.0f;
+    float load_current = sqrtf(SQ(field_weakening_Id_) + SQ(last_Iq_));
+    if (!config_.enable_resistance_estimation || !(config_.resistance_est_injection_freq > 0.0f)
+            || !dead_time_compensated || load_current < 2.0f * config_.dead_time_current_band) {
+        resistance_est_count_ = 0;
+        resistance_est_V_sum_ = 0.0f;
+        resistance_est_I_sum_ = 0.0f;
+        resistance_est_period_valid_ = true;
+        resistance_est_Id_ = 0.0f;
+        return 0.0f;
+    }
+    if (!(phase_resistance_est_ > 0.0f))
+        phase_resistance_est_ = config_.phase_resistance;
+
+    uint32_t half_period = static_cast<uint32_t>(0.5f / (config_.resistance_est_injection_freq * current_meas_period));
+    half_period = std::max(half_period, (uint32_t)2);
+
+    // The last measurement belongs to the injection of the previous cycle
+    float sign = (resistance_est_count_ < half_period) ? 1.0f : -1.0f;
+    if (resistance_est_count_ % half_period >= half_period / 2) {
+        resistance_est_V_sum_ += sign * last_Vd_;
+        resistance_est_I_sum_ += sign * last_Id_;
+    }
+    if (current_control_.mod_demand_ratio > 1.0f)
+        resistance_est_period_valid_ = false;
+
+    if (++resistance_est_count_ >= 2 * half_period) {
+        // Only accept periods in which the injection actually flowed
+        float I_min = 0.5f * config_.resistance_est_injection_current * (float)half_period;
+        if (resistance_est_period_valid_ && resistance_est_I_sum_ > I_min) {
+            float R = resistance_est_V_sum_ / resistance_est_I_sum_;
+            float k = std::min((float)(2 * half_period) * current_meas_period / config_.resistance_est_tau, 1.0f);
+            phase_resistance_est_ += (R - phase_resistance_est_) * k;
+            winding_temp_est_ = config_.resistance_calib_temp
+                    + (phase_resistance_est_ / config_.phase_resistance - 1.0f) / kCopperTempco;
+            update_current_controller_gains();
+        }
+        resistance_est_count_ = 0;
+        resistance_est_V_sum_ = 0.0f;
+        resistance_est_I_sum_ = 0.0f;
+        resistance_est_period_valid_ = true;
+    }
+
+    float injection_sign = (resistance_est_count_ < half_period) ? 1.0f : -1.0f;
+    resistance_est_Id_ = injection_sign * config_.resistance_est_injection_current;
+    return resistance_est_Id_;
+}
+
+bool Motor::FOC_current(float Id_des, float Iq_des, float I_phase, float pwm_phase, float phase_vel) {
     // Syntactic sugar
     CurrentControl_t& ictrl = current_control_;
 
     // For Reporting
     ictrl.Iq_setpoint = Iq_des;
 
+    // The current was sampled with the timings of the previous cycle
+    bool sample_valid = timings_sample_valid_;
+
     // Check for current sense saturation
+    // This runs on stale samples too: a phase whose low side is off reads
+    // close to zero, so a reading above the trip level is never spurious.
     if (fabsf(current_meas_.phB) > ictrl.overcurrent_trip_level
-     || fabsf(current_meas_.phC) > ictrl.overcurrent_trip_level) {
+            || fabsf(current_meas_.phC) > ictrl.overcurrent_trip_level) {
         set_error(ERROR_CURRENT_SENSE_SATURATION);
     }
 
@@ -353,6 +911,34 @@ bool Motor::FOC_current(float Id_des, float Iq_des, float I_phase, float pwm_pha
     float s_I = our_arm_sin_f32(I_phase);
     float Id = c_I * Ialpha + s_I * Ibeta;
     float Iq = c_I * Ibeta - s_I * Ialpha;
+    if (sample_valid) {
+        // The average of oversampled currents is current_meas_delay later than
+        // the middle of the zero vector, where a sample equals the mean current
+        // of the PWM period. No voltage is applied in between, so the current
+        // decays with L*di/dt = -R*i - omega*flux_linkage, which is undone here.
+        if (current_meas_delay > 0.0f && config_.phase_inductance > 0.0f) {
+            float Ld = config_.phase_inductance;
+            float Lq = config_.phase_inductance;
+            if (config_.enable_mtpa) {
+                Ld = config_.phase_inductance_d;
+                Lq = config_.phase_inductance_q;
+            }
+            float R = phase_resistance();
+            float flux_linkage = axis_->sensorless_estimator_.config_.pm_flux_linkage;
+            Id += current_meas_delay * R * Id / Ld;
+            Iq += current_meas_delay * (R * Iq + phase_vel * flux_linkage) / Lq;
+        }
+        last_Id_ = Id;
+        last_Iq_ = Iq;
+        stale_current_samples_ = 0;
+    } else {
+        // No sampling window in overmodulation, the rotor frame currents
+        // change slowly enough to reuse the last sample for a few cycles
+        Id = last_Id_;
+        Iq = last_Iq_;
+        ++skipped_current_samples_;
+        ++stale_current_samples_;
+    }
     ictrl.Iq_measured += ictrl.I_measured_report_filter_k * (Iq - ictrl.Iq_measured);
     ictrl.Id_measured += ictrl.I_measured_report_filter_k * (Id - ictrl.Id_measured);
 
@@ -360,19 +946,44 @@ bool Motor::FOC_current(float Id_des, float Iq_des, float I_phase, float pwm_pha
     float Ierr_d = Id_des - Id;
     float Ierr_q = Iq_des - Iq;
 
-    // TODO look into feed forward terms (esp omega, since PI pole maps to RL tau)
+    // Feed forward of the rotational voltages of the dq model
+    //   Vd = R*Id + L*dId/dt - omega*L*Iq
+    //   Vq = R*Iq + L*dIq/dt + omega*L*Id + omega*flux_linkage
+    // so that the PI controllers only see the RL plant they are tuned for.
+    // The cross coupling is cancelled with the measured currents, which
+    // works during transients too (see analysis/current_control).
+    float Vd_ff = 0.0f;
+    float Vq_ff = 0.0f;
+    if (config_.enable_current_decoupling) {
+        float Ld = config_.phase_inductance;
+        float Lq = config_.phase_inductance;
+        if (config_.enable_mtpa) {
+            Ld = config_.phase_inductance_d;
+            Lq = config_.phase_inductance_q;
+        }
+        Vd_ff -= phase_vel * Lq * Iq;
+        Vq_ff += phase_vel * Ld * Id;
+    }
+    if (config_.enable_back_emf_feedforward) {
+        Vq_ff += phase_vel * axis_->sensorless_estimator_.config_.pm_flux_linkage;
+    }
+    ictrl.v_feedforward_d = Vd_ff;
+    ictrl.v_feedforward_q = Vq_ff;
+
     // Apply PI control
-    float Vd = ictrl.v_current_control_integral_d + Ierr_d * ictrl.p_gain;
-    float Vq = ictrl.v_current_control_integral_q + Ierr_q * ictrl.p_gain;
+    float Vd = Vd_ff + ictrl.v_current_control_integral_d + Ierr_d * ictrl.p_gain;
+    float Vq = Vq_ff + ictrl.v_current_control_integral_q + Ierr_q * ictrl.p_gain;
 
-    float mod_to_V = (2.0f / 3.0f) * vbus_voltage;
+    float mod_to_V = (2.0f / 3.0f) * modulation_vbus();
     float V_to_mod = 1.0f / mod_to_V;
     float mod_d = V_to_mod * Vd;
     float mod_q = V_to_mod * Vq;
 
     // Vector modulation saturation, lock integrator if saturated
-    // TODO make maximum modulation configurable
-    float mod_scalefactor = 0.80f * sqrt3_by_2 * 1.0f / sqrtf(mod_d * mod_d + mod_q * mod_q);
+    float max_mod = max_modulation();
+    float mod_magnitude = sqrtf(mod_d * mod_d + mod_q * mod_q);
+    ictrl.mod_demand_ratio = mod_magnitude / max_mod;
+    float mod_scalefactor = max_mod / mod_magnitude;
     if (mod_scalefactor < 1.0f) {
         mod_d *= mod_scalefactor;
         mod_q *= mod_scalefactor;
@@ -383,6 +994,7 @@ bool Motor::FOC_current(float Id_des, float Iq_des, float I_phase, float pwm_pha
         ictrl.v_current_control_integral_d += Ierr_d * (ictrl.i_gain * current_meas_period);
         ictrl.v_current_control_integral_q += Ierr_q * (ictrl.i_gain * current_meas_period);
     }
+    last_Vd_ = mod_to_V * mod_d;
 
     // Compute estimated bus current
     ictrl.Ibus = mod_d * Id + mod_q * Iq;
@@ -393,10 +1005,42 @@ bool Motor::FOC_current(float Id_des, float Iq_des, float I_phase, float pwm_pha
     float mod_alpha = c_p * mod_d - s_p * mod_q;
     float mod_beta  = c_p * mod_q + s_p * mod_d;
 
+    // Beyond the linear range the applied vector differs from the requested
+    // fundamental by harmonics, which are reported as v_harmonic
+    float mod_fundamental = std::min(mod_magnitude, max_mod);
+    ictrl.modulation_index = mod_fundamental / kSixStepFundamental;
+    ictrl.v_harmonic = 0.0f;
+    if (config_.modulation_mode == MODULATION_MODE_OVERMODULATION && mod_fundamental > sqrt3_by_2) {
+        float fund_alpha = mod_alpha;
+        float fund_beta = mod_beta;
+        overmodulate(&mod_alpha, &mod_beta, mod_fundamental);
+        float harm_alpha = mod_alpha - fund_alpha;
+        float harm_beta = mod_beta - fund_beta;
+        ictrl.v_harmonic = mod_to_V * sqrtf(harm_alpha * harm_alpha + harm_beta * harm_beta);
+    }
+
     // Report final applied voltage in stationary frame (for sensorles estimator)
     ictrl.final_v_alpha = mod_to_V * mod_alpha;
     ictrl.final_v_beta = mod_to_V * mod_beta;
 
+    // Dead time compensation: each phase loses dead_time_voltage in the
+    // direction of its current. The current over the next cycle is predicted
+    // from the setpoint, and the sign is smoothed over dead_time_current_band
+    // to avoid chattering around the zero crossings.
+    if (config_.enable_dead_time_compensation && config_.dead_time_current_band > 0.0f) {
+        float I_alpha = c_p * Id_des - s_p * Iq_des;
+        float I_beta  = c_p * Iq_des + s_p * Id_des;
+        float band_inv = 1.0f / config_.dead_time_current_band;
+        float sA = std::max(-1.0f, std::min(band_inv * I_alpha, 1.0f));
+        float sB = std::max(-1.0f, std::min(band_inv * (-0.5f * I_alpha + sqrt3_by_2 * I_beta), 1.0f));
+        float sC = std::max(-1.0f, std::min(band_inv * (-0.5f * I_alpha - sqrt3_by_2 * I_beta), 1.0f));
+        // Clarke transform of the per phase voltage errors
+        float mod_comp = V_to_mod * config_.dead_time_voltage * (2.0f / 3.0f);
+        mod_alpha += mod_comp * (sA - 0.5f * (sB + sC));
+        mod_beta += mod_comp * sqrt3_by_2 * (sB - sC);
+        clip_to_hexagon(&mod_alpha, &mod_beta);
+    }
+
     // Apply SVM
     if (!enqueue_modulation_timings(mod_alpha, mod_beta))
         return false; // error set inside enqueue_modulation_timings
@@ -416,7 +1060,22 @@ bool Motor::update(float current_setpoint, float phase, float phase_vel) {
     // Execute current command
     // TODO: move this into the mot
     if (config_.motor_type == MOTOR_TYPE_HIGH_CURRENT) {
-        if(!FOC_current(0.0f, current_setpoint, phase, pwm_phase)){
+        float Id_setpoint = update_field_weakening();
+        Id_setpoint += update_resistance_estimation();
+        float Iq_setpoint = current_setpoint;
+        if (config_.enable_mtpa) {
+            float Id_mtpa;
+            mtpa_current_split(current_setpoint, &Id_mtpa, &Iq_setpoint);
+            Id_setpoint += Id_mtpa;
+        }
+        // The Iq command is limited against the Id of the last cycle, so
+        // enforce the limit on the total current here, with Id first
+        float I_lim = total_current_lim();
+        Id_setpoint = std::max(-I_lim, std::min(Id_setpoint, I_lim));
+        float Iq_lim = sqrtf(std::max(I_lim * I_lim - Id_setpoint * Id_setpoint, 0.0f));
+        Iq_setpoint = std::max(-Iq_lim, std::min(Iq_setpoint, Iq_lim));
+        current_control_.Id_setpoint = Id_setpoint;
+        if(!FOC_current(Id_setpoint, Iq_setpoint, phase, pwm_phase, phase_vel)){
             return false;
         }
     } else if (config_.motor_type == MOTOR_TYPE_GIMBAL) {
@@ -22,7 +22,9 @@ public:
         ERROR_BRAKE_DEADTIME_VIOLATION = 0x0100,
         ERROR_UNEXPECTED_TIMER_CALLBACK = 0x0200,
         ERROR_CURRENT_SENSE_SATURATION = 0x0400,
-        ERROR_INVERTER_OVER_TEMP = 0x0800
+        ERROR_INVERTER_OVER_TEMP = 0x0800,
+        ERROR_FLUX_LINKAGE_OUT_OF_RANGE = 0x1000,
+        ERROR_CALIBRATION_TIMEOUT = 0x2000,
     };
 
     enum MotorType_t {
@@ -31,6 +33,12 @@ public:
         MOTOR_TYPE_GIMBAL = 2
     };
 
+    enum ModulationMode_t {
+        MODULATION_MODE_LINEAR_LIMITED = 0, // 80% of the linear range, leaves a fixed current sampling window
+        MODULATION_MODE_LINEAR = 1,         // full linear range, the circle inside the SVM hexagon
+        MODULATION_MODE_OVERMODULATION = 2  // overmodulation regions I and II, up to six-step
+    };
+
     struct Iph_BC_t {
         float phB;
         float phC;
@@ -42,12 +50,18 @@ public:
         float v_current_control_integral_d; // [V]
         float v_current_control_integral_q; // [V]
         float Ibus; // DC bus current [A]
+        float modulation_index; // fundamental of the applied voltage relative to six-step
+        float v_harmonic; // [V] difference between the applied voltage and its fundamental
         // Voltage applied at end of cycle:
         float final_v_alpha; // [V]
         float final_v_beta; // [V]
         float Iq_setpoint; // [A]
+        float Id_setpoint; // [A]
         float Iq_measured; // [A]
         float Id_measured; // [A]
+        float v_feedforward_d; // [V]
+        float v_feedforward_q; // [V]
+        float mod_demand_ratio; // modulation requested by the PI loops, relative to the maximum
         float I_measured_report_filter_k;
         float max_allowed_current; // [A]
         float overcurrent_trip_level; // [A]
@@ -61,8 +75,24 @@ public:
         int32_t pole_pairs = 7;
         float calibration_current = 10.0f;    // [A]
         float resistance_calib_max_voltage = 2.0f; // [V] - You may need to increase this if this voltage isn't sufficient to drive calibration_current through the motor.
+        float calibration_accuracy = 0.01f;   // relative accuracy at which the resistance and inductance measurements stop
+        float calibration_timeout = 3.0f;     // [s] maximum duration of each resistance and inductance measurement
+        float flux_linkage_calib_vel = 200.0f;   // [rad/s] highest electrical speed of the flux linkage calibration
+        float flux_linkage_calib_accel = 100.0f; // [rad/s^2] electrical acceleration of the flux linkage calibration
         float phase_inductance = 0.0f;        // to be set by measure_phase_inductance
         float phase_resistance = 0.0f;        // to be set by measure_phase_resistance
+        float resistance_calib_temp = 25.0f;  // [degC] winding temperature at which phase_resistance was measured
+        bool enable_resistance_estimation = false;    // track the winding resistance and temperature online
+        float resistance_est_injection_current = 0.5f; // [A] amplitude of the square wave Id injection
+        float resistance_est_injection_freq = 10.0f;   // [Hz]
+        float resistance_est_tau = 10.0f;              // [s] time constant of the resistance estimate
+        float winding_temp_limit_lower = 100.0f;       // [degC] current derating starts here if the estimation is enabled
+        float winding_temp_limit_upper = 120.0f;       // [degC] no current left here
+        MotorThermalModel::Config_t thermal_model;
+        bool enable_mtpa = false;             // split the current command into Id and Iq for maximum torque per amp (salient motors)
+        float phase_inductance_d = 0.0f;      // [H] measured in the calibration if enable_mtpa is set
+        float phase_inductance_q = 0.0f;      // [H] measured in the calibration if enable_mtpa is set
+        float torque_constant = 0.04f;        // [Nm/A] { 8.27 / <rpm/v> }
         int32_t direction = 0;                // 1 or -1 (0 = unspecified)
         MotorType_t motor_type = MOTOR_TYPE_HIGH_CURRENT;
         // Read out max_allowed_current to see max supported value for current_lim.
@@ -71,6 +101,19 @@ public:
         // Value used to compute shunt amplifier gains
         float requested_current_range = 60.0f; // [A]
         float current_control_bandwidth = 1000.0f;  // [rad/s]
+        bool enable_current_decoupling = false;   // feed forward the omega*L cross coupling between the d and q axes
+        bool enable_back_emf_feedforward = false; // feed forward omega*flux_linkage, see sensorless_estimator.config.pm_flux_linkage
+        bool enable_field_weakening = false;
+        float field_weakening_max_current = 10.0f; // [A] largest negative Id that is injected
+        float field_weakening_modulation = 0.95f;  // ratio of the maximum modulation above which Id is injected
+        float field_weakening_gain = 10000.0f;     // [A/s] Id rate per unit of excess modulation ratio
+        ModulationMode_t modulation_mode = MODULATION_MODE_LINEAR_LIMITED;
+        float current_sample_window = 2.0e-6f; // [s] low side on-time needed for a valid current sample
+        uint32_t max_stale_current_samples = 4; // consecutive cycles without a valid current sample before the modulation falls back to the limited linear range
+        bool enable_dead_time_compensation = false;
+        float dead_time_voltage = 0.0f;       // [V] phase voltage lost to the dead time and device drops, measured by the calibration if the compensation is enabled
+        float dead_time_current_band = 1.0f;  // [A] phase current over which the compensation changes sign
+        bool enable_vbus_compensation = false; // convert voltages to modulation with the bus voltage sampled together with the currents instead of the filtered one
         float inverter_temp_limit_lower = 100;
         float inverter_temp_limit_upper = 120;
     };
@@ -113,16 +156,29 @@ public:
     bool do_checks();
     float get_inverter_temp();
     bool update_thermal_limits();
+    float total_current_lim();
     float effective_current_lim();
     void log_timing(TimingLog_t log_idx);
-    float phase_current_from_adcval(uint32_t ADCValue);
+    float phase_current_from_adcval(float ADCValue);
+    bool measure_resistance_voltage(float test_current, float max_voltage, float* test_voltage, float* rel_error);
     bool measure_phase_resistance(float test_current, float max_voltage);
+    bool measure_dead_time_voltage(float test_current, float max_voltage);
+    bool measure_inductance(float voltage_low, float voltage_high, float dir_alpha, float dir_beta, float* L, float* rel_error);
     bool measure_phase_inductance(float voltage_low, float voltage_high);
+    bool measure_dq_inductance(float voltage_low, float voltage_high);
+    bool measure_flux_linkage();
+    void mtpa_current_split(float current_setpoint, float* Id, float* Iq);
     bool run_calibration();
+    float max_modulation();
+    float modulation_vbus();
+    void apply_sample_window(float* tA, float* tB, float* tC);
     bool enqueue_modulation_timings(float mod_alpha, float mod_beta);
     bool enqueue_voltage_timings(float v_alpha, float v_beta);
     bool FOC_voltage(float v_d, float v_q, float pwm_phase);
-    bool FOC_current(float Id_des, float Iq_des, float I_phase, float pwm_phase);
+    float update_field_weakening();
+    float update_resistance_estimation();
+    float phase_resistance();
+    bool FOC_current(float Id_des, float Iq_des, float I_phase, float pwm_phase, float phase_vel);
     bool update(float current_setpoint, float phase, float phase_vel);
 
     const MotorHardwareConfig_t& hw_config_;
@@ -139,6 +195,10 @@ public:
         TIM_1_8_PERIOD_CLOCKS / 2
     };
     bool next_timings_valid_ = false;
+    // Whether the timings leave enough time around the current sample (V0)
+    // and the DC calibration sample (V7), see apply_sample_window
+    bool timings_sample_valid_ = true;
+    bool timings_dc_calib_valid_ = true;
     uint16_t last_cpu_time_ = 0;
     int timing_log_index_ = 0;
     uint16_t timing_log_[TIMING_LOG_NUM_SLOTS] = { 0 };
@@ -158,11 +218,17 @@ public:
         .v_current_control_integral_d = 0.0f,
         .v_current_control_integral_q = 0.0f,
         .Ibus = 0.0f,
+        .modulation_index = 0.0f,
+        .v_harmonic = 0.0f,
         .final_v_alpha = 0.0f,
         .final_v_beta = 0.0f,
         .Iq_setpoint = 0.0f,
+        .Id_setpoint = 0.0f,
         .Iq_measured = 0.0f,
         .Id_measured = 0.0f,
+        .v_feedforward_d = 0.0f,
+        .v_feedforward_q = 0.0f,
+        .mod_demand_ratio = 0.0f,
         .I_measured_report_filter_k = 1.0f,
         .max_allowed_current = 0.0f,
         .overcurrent_trip_level = 0.0f,
@@ -170,6 +236,25 @@ public:
     DRV8301_FaultType_e drv_fault_ = DRV8301_FaultType_NoFault;
     DRV_SPI_8301_Vars_t gate_driver_regs_; //Local view of DRV registers (initialized by DRV8301_setup)
     float thermal_current_lim_ = 10.0f;  //[A]
+    MotorThermalModel thermal_model_;
+    float field_weakening_Id_ = 0.0f;  // [A] state of the field weakening integrator
+    float mtpa_Iq_ = 0.0f;  // [A] last MTPA solution, to warm start the next one
+    float mtpa_Id_ = 0.0f;  // [A]
+    float last_Id_ = 0.0f;  // [A] last valid current measurement
+    float last_Iq_ = 0.0f;  // [A]
+    float last_Vd_ = 0.0f;  // [V] last d axis voltage of the current controller
+    float phase_resistance_est_ = 0.0f;  // [Ohm] online estimate, 0 until the estimation runs
+    float winding_temp_est_ = 0.0f;      // [degC] derived from phase_resistance_est_
+    uint32_t resistance_est_count_ = 0;  // position in the injection period [cycles]
+    float resistance_est_V_sum_ = 0.0f;
+    float resistance_est_I_sum_ = 0.0f;
+    bool resistance_est_period_valid_ = true;
+    float resistance_est_Id_ = 0.0f;     // [A] injection of the last cycle
+    uint32_t skipped_current_samples_ = 0;
+    uint32_t stale_current_samples_ = 0;  // consecutive cycles without a valid current sample
+    float vbus_meas_ = 12.0f;  // [V] bus voltage sampled together with current_meas_
+    float phase_resistance_rel_error_ = 0.0f;  // estimated relative error of the last resistance calibration
+    float phase_inductance_rel_error_ = 0.0f;  // estimated relative error of the last inductance calibration
 
     // Communication protocol definitions
     auto make_protocol_definitions() {
@@ -183,18 +268,31 @@ public:
             make_protocol_property("DC_calib_phC", &DC_calib_.phC),
             make_protocol_property("phase_current_rev_gain", &phase_current_rev_gain_),
             make_protocol_ro_property("thermal_current_lim", &thermal_current_lim_),
+            make_protocol_ro_property("skipped_current_samples", &skipped_current_samples_),
+            make_protocol_ro_property("vbus_meas", &vbus_meas_),
+            make_protocol_ro_property("phase_resistance_rel_error", &phase_resistance_rel_error_),
+            make_protocol_ro_property("phase_inductance_rel_error", &phase_inductance_rel_error_),
+            make_protocol_ro_property("phase_resistance_est", &phase_resistance_est_),
+            make_protocol_ro_property("winding_temp_est", &winding_temp_est_),
             make_protocol_function("get_inverter_temp", *this, &Motor::get_inverter_temp),
+            make_protocol_object("thermal_model", thermal_model_.make_protocol_definitions()),
             make_protocol_object("current_control",
                 make_protocol_property("p_gain", &current_control_.p_gain),
                 make_protocol_property("i_gain", &current_control_.i_gain),
                 make_protocol_property("v_current_control_integral_d", &current_control_.v_current_control_integral_d),
                 make_protocol_property("v_current_control_integral_q", &current_control_.v_current_control_integral_q),
                 make_protocol_property("Ibus", &current_control_.Ibus),
+                make_protocol_ro_property("modulation_index", &current_control_.modulation_index),
+                make_protocol_ro_property("v_harmonic", &current_control_.v_harmonic),
                 make_protocol_property("final_v_alpha", &current_control_.final_v_alpha),
                 make_protocol_property("final_v_beta", &current_control_.final_v_beta),
                 make_protocol_property("Iq_setpoint", &current_control_.Iq_setpoint),
+                make_protocol_ro_property("Id_setpoint", &current_control_.Id_setpoint),
                 make_protocol_property("Iq_measured", &current_control_.Iq_measured),
                 make_protocol_property("Id_measured", &current_control_.Id_measured),
+                make_protocol_ro_property("v_feedforward_d", &current_control_.v_feedforward_d),
+                make_protocol_ro_property("v_feedforward_q", &current_control_.v_feedforward_q),
+                make_protocol_ro_property("mod_demand_ratio", &current_control_.mod_demand_ratio),
                 make_protocol_property("I_measured_report_filter_k", &current_control_.I_measured_report_filter_k),
                 make_protocol_ro_property("max_allowed_current", &current_control_.max_allowed_current),
                 make_protocol_ro_property("overcurrent_trip_level", &current_control_.overcurrent_trip_level)
@@ -222,8 +320,23 @@ public:
                 make_protocol_property("pole_pairs", &config_.pole_pairs),
                 make_protocol_property("calibration_current", &config_.calibration_current),
                 make_protocol_property("resistance_calib_max_voltage", &config_.resistance_calib_max_voltage),
+                make_protocol_property("calibration_accuracy", &config_.calibration_accuracy),
+                make_protocol_property("calibration_timeout", &config_.calibration_timeout),
+                make_protocol_property("resistance_calib_temp", &config_.resistance_calib_temp),
+                make_protocol_property("enable_resistance_estimation", &config_.enable_resistance_estimation),
+                make_protocol_property("resistance_est_injection_current", &config_.resistance_est_injection_current),
+                make_protocol_property("resistance_est_injection_freq", &config_.resistance_est_injection_freq),
+                make_protocol_property("resistance_est_tau", &config_.resistance_est_tau),
+                make_protocol_property("winding_temp_limit_lower", &config_.winding_temp_limit_lower),
+                make_protocol_property("winding_temp_limit_upper", &config_.winding_temp_limit_upper),
+                make_protocol_property("flux_linkage_calib_vel", &config_.flux_linkage_calib_vel),
+                make_protocol_property("flux_linkage_calib_accel", &config_.flux_linkage_calib_accel),
                 make_protocol_property("phase_inductance", &config_.phase_inductance),
                 make_protocol_property("phase_resistance", &config_.phase_resistance),
+                make_protocol_property("enable_mtpa", &config_.enable_mtpa),
+                make_protocol_property("phase_inductance_d", &config_.phase_inductance_d),
+                make_protocol_property("phase_inductance_q", &config_.phase_inductance_q),
+                make_protocol_property("torque_constant", &config_.torque_constant),
                 make_protocol_property("direction", &config_.direction),
                 make_protocol_property("motor_type", &config_.motor_type),
                 make_protocol_property("current_lim", &config_.current_lim),
@@ -231,7 +344,20 @@ public:
                 make_protocol_property("inverter_temp_limit_upper", &config_.inverter_temp_limit_upper),
                 make_protocol_property("requested_current_range", &config_.requested_current_range),
                 make_protocol_property("current_control_bandwidth", &config_.current_control_bandwidth,
-                    [](void* ctx) { static_cast<Motor*>(ctx)->update_current_controller_gains(); }, this)
+                    [](void* ctx) { static_cast<Motor*>(ctx)->update_current_controller_gains(); }, this),
+                make_protocol_property("enable_current_decoupling", &config_.enable_current_decoupling),
+                make_protocol_property("enable_back_emf_feedforward", &config_.enable_back_emf_feedforward),
+                make_protocol_property("enable_field_weakening", &config_.enable_field_weakening),
+                make_protocol_property("field_weakening_max_current", &config_.field_weakening_max_current),
+                make_protocol_property("field_weakening_modulation", &config_.field_weakening_modulation),
+                make_protocol_property("field_weakening_gain", &config_.field_weakening_gain),
+                make_protocol_property("modulation_mode", &config_.modulation_mode),
+                make_protocol_property("current_sample_window", &config_.current_sample_window),
+                make_protocol_property("max_stale_current_samples", &config_.max_stale_current_samples),
+                make_protocol_property("enable_dead_time_compensation", &config_.enable_dead_time_compensation),
+                make_protocol_property("dead_time_voltage", &config_.dead_time_voltage),
+                make_protocol_property("dead_time_current_band", &config_.dead_time_current_band),
+                make_protocol_property("enable_vbus_compensation", &config_.enable_vbus_compensation)
             )
         );
     }
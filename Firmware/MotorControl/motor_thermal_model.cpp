@@ -0,0 +1,63 @@
+
+#include "odrive_main.h"
+
+static const float kCopperTempco = 0.00393f; // [1/degC]
+
+MotorThermalModel::MotorThermalModel(Config_t& config) :
+    config_(config)
+{
+    reset();
+}
+
+// @brief Assumes that the motor has cooled down to the ambient temperature.
+// The current limit for this state is evaluated by the next update(), i.e.
+// in the same control cycle, rather than after the next model step.
+void MotorThermalModel::reset() {
+    winding_temp_ = config_.ambient_temp;
+    housing_temp_ = config_.ambient_temp;
+    current_lim_valid_ = false;
+    I_sq_sum_ = 0.0f;
+    num_samples_ = 0;
+}
+
+// @brief Accumulates the copper losses of one control cycle, and advances the
+// model every kDecimation cycles.
+// @param I_sq: square of the dq current magnitude [A^2]
+// @param R_ref, T_ref: phase resistance [Ohm] at the temperature T_ref [degC]
+void MotorThermalModel::update(float I_sq, float R_ref, float T_ref) {
+    if (!current_lim_valid_)
+        update_current_lim(R_ref, T_ref);
+    I_sq_sum_ += I_sq;
+    if (++num_samples_ < kDecimation)
+        return;
+
+    const float dt = (float)num_samples_ * current_meas_period;
+    const float I_sq_mean = I_sq_sum_ / (float)num_samples_;
+    I_sq_sum_ = 0.0f;
+    num_samples_ = 0;
+
+    // Losses of all three phases, with the resistance at the winding temperature
+    float R = R_ref * (1.0f + kCopperTempco * (winding_temp_ - T_ref));
+    float P = 1.5f * I_sq_mean * R;
+    float P_wh = (winding_temp_ - housing_temp_) / config_.winding_to_housing;
+    float P_ha = (housing_temp_ - config_.ambient_temp) / config_.housing_to_ambient;
+    winding_temp_ += dt * (P - P_wh) / config_.winding_capacity;
+    housing_temp_ += dt * (P_wh - P_ha) / config_.housing_capacity;
+
+    update_current_lim(R_ref, T_ref);
+}
+
+void MotorThermalModel::update_current_lim(float R_ref, float T_ref) {
+    // Over burst_time the housing temperature barely changes, and the winding
+    // approaches housing_temp_ + P * R_wh with the time constant C_w * R_wh.
+    // Solve for the power that reaches winding_temp_limit at the end.
+    float tau = config_.winding_capacity * config_.winding_to_housing;
+    float a = expf(-config_.burst_time / tau);
+    float P_max = ((config_.winding_temp_limit - housing_temp_) - (winding_temp_ - housing_temp_) * a)
+                / (config_.winding_to_housing * (1.0f - a));
+    float R_limit = R_ref * (1.0f + kCopperTempco * (config_.winding_temp_limit - T_ref));
+    current_lim_ = sqrtf(std::max(P_max, 0.0f) / (1.5f * R_limit));
+    if (!(current_lim_ >= 0.0f)) // also catches NaN from an invalid config
+        current_lim_ = 0.0f;
+    current_lim_valid_ = true;
+}
@@ -0,0 +1,71 @@
+#ifndef __MOTOR_THERMAL_MODEL_HPP
+#define __MOTOR_THERMAL_MODEL_HPP
+
+#ifndef __ODRIVE_MAIN_H
+#error "This file should not be included directly. Include odrive_main.h instead."
+#endif
+
+// @brief Two node thermal model of the motor: the winding, heated by the
+// copper losses, and the housing, which takes heat from the winding and
+// gives it off to the ambient.
+//   C_w * dT_w/dt = P - (T_w - T_h) / R_wh
+//   C_h * dT_h/dt = (T_w - T_h) / R_wh - (T_h - T_amb) / R_ha
+// The copper losses are accumulated every control cycle and the model is
+// evaluated at a low rate. From the temperatures it predicts the current
+// that brings the winding to its limit within burst_time, which allows short
+// bursts above the continuous rating while the winding is cool.
+class MotorThermalModel {
+public:
+    struct Config_t {
+        bool enabled = false;
+        float winding_capacity = 40.0f;      // [J/K]
+        float housing_capacity = 150.0f;     // [J/K]
+        float winding_to_housing = 0.5f;     // [K/W] thermal resistance
+        float housing_to_ambient = 1.5f;     // [K/W] thermal resistance
+        float ambient_temp = 25.0f;          // [degC] may be updated by the host from an external sensor
+        float winding_temp_limit = 120.0f;   // [degC]
+        float burst_time = 1.0f;             // [s] horizon of the current limit
+    };
+
+    static constexpr uint32_t kDecimation = 80; // control cycles per model step
+
+    explicit MotorThermalModel(Config_t& config);
+
+    void reset();
+    void update(float I_sq, float R_ref, float T_ref);
+
+    Config_t& config_;
+
+    float winding_temp_ = 0.0f;  // [degC]
+    float housing_temp_ = 0.0f;  // [degC]
+    float current_lim_ = 0.0f;   // [A] limit on the magnitude of the total current
+    bool current_lim_valid_ = false; // false until the limit is evaluated after a reset
+    float I_sq_sum_ = 0.0f;      // [A^2] accumulated since the last model step
+    uint32_t num_samples_ = 0;
+
+private:
+    void update_current_lim(float R_ref, float T_ref);
+
+public:
+    // Communication protocol definitions
+    auto make_protocol_definitions() {
+        return make_protocol_member_list(
+            make_protocol_ro_property("winding_temp", &winding_temp_),
+            make_protocol_ro_property("housing_temp", &housing_temp_),
+            make_protocol_ro_property("current_lim", &current_lim_),
+            make_protocol_object("config",
+                make_protocol_property("enabled", &config_.enabled),
+                make_protocol_property("winding_capacity", &config_.winding_capacity),
+                make_protocol_property("housing_capacity", &config_.housing_capacity),
+                make_protocol_property("winding_to_housing", &config_.winding_to_housing),
+                make_protocol_property("housing_to_ambient", &config_.housing_to_ambient),
+                make_protocol_property("ambient_temp", &config_.ambient_temp),
+                make_protocol_property("winding_temp_limit", &config_.winding_temp_limit),
+                make_protocol_property("burst_time", &config_.burst_time)
+            ),
+            make_protocol_function("reset", *this, &MotorThermalModel::reset)
+        );
+    }
+};
+
+#endif // __MOTOR_THERMAL_MODEL_HPP
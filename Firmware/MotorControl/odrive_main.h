@@ -71,6 +71,7 @@ struct BoardConfig_t {
     bool enable_uart = true;
     bool enable_i2c_instead_of_can = false;
     bool enable_ascii_protocol_on_usb = true;
+    bool enable_uart_event_notifications = false; //<! send an ASCII line on UART when an axis raises an event
 #if HW_VERSION_MAJOR == 3 && HW_VERSION_MINOR >= 5 && HW_VERSION_VOLTAGE >= 48
     float brake_resistance = 2.0f;     // [ohm]
 #else
@@ -81,6 +82,12 @@ struct BoardConfig_t {
                                                                         //<! This protects against cases in which the power supply fails to dissipate
                                                                         //<! the brake power if the brake resistor is disabled.
                                                                         //<! The default is 26V for the 24V board version and 52V for the 48V board version.
+    float dc_bus_voltage_filter_tau = 0.0f;                             //<! [s] time constant of an optional filter on vbus_voltage, which the protection logic uses.
+                                                                        //<! 0 disables the filter. The filter delays the over/undervoltage trips.
+    bool enable_simultaneous_adc = false;                               //<! read both phase currents of a motor in one ADC interrupt (needed for oversampling).
+                                                                        //<! Takes effect after a reboot.
+    uint32_t current_meas_oversampling = 1;                             //<! number of ADC conversions averaged per current measurement, 1 to 4.
+                                                                        //<! Requires enable_simultaneous_adc. Takes effect after a reboot.
     PWMMapping_t pwm_mappings[GPIO_COUNT];
     PWMMapping_t analog_mappings[GPIO_COUNT];
 };
@@ -115,9 +122,16 @@ inline ENUMTYPE operator ~ (ENUMTYPE a) { return static_cast<ENUMTYPE>(~static_c
 #include <low_level.h>
 #include <encoder.hpp>
 #include <sensorless_estimator.hpp>
+#include <input_shaper.hpp>
+#include <repetitive_control.hpp>
+#include <inertia_estimator.hpp>
+#include <pvt_fifo.hpp>
+#include <motion_table.hpp>
+#include <motor_thermal_model.hpp>
 #include <controller.hpp>
 #include <motor.hpp>
 #include <trapTraj.hpp>
+#include <scurveTraj.hpp>
 #include <axis.hpp>
 #include <communication/communication.h>
 
@@ -0,0 +1,91 @@
+
+#include <stdlib.h>
+#include "odrive_main.h"
+
+PvtFifo::PvtFifo(Config_t& config) :
+    config_(config)
+{
+    uint32_t depth = config_.depth;
+    if (depth > kMaxDepth)
+        depth = kMaxDepth;
+    buffer_ = (Point_t*)malloc((depth + 1) * sizeof(Point_t));
+    buffer_size_ = buffer_ ? depth + 1 : 0;
+}
+
+// @brief Appends a point, to be reached dt seconds after the previous one.
+// @returns false if the queue is full or the point is invalid
+bool PvtFifo::push(float pos, float vel, float dt) {
+    if (buffer_size_ == 0 || !(dt > 0.0f))
+        return false;
+    uint32_t tail = tail_;
+    uint32_t next = (tail + 1) % buffer_size_;
+    if (next == head_)
+        return false; // full
+    buffer_[tail] = { pos, vel, dt };
+    tail_ = next; // publish only after the point is written
+    return true;
+}
+
+// @brief Drops all queued points. The axis holds the last reached point.
+void PvtFifo::clear() {
+    uint32_t prim = cpu_enter_critical();
+    head_ = tail_;
+    cpu_exit_critical(prim);
+}
+
+// @brief Starts interpolating from the given state towards the first point.
+void PvtFifo::start(float pos, float vel) {
+    start_pos_ = pos;
+    start_vel_ = vel;
+    elapsed_ = 0.0f;
+    underrun_ = false;
+}
+
+uint32_t PvtFifo::get_count() {
+    if (buffer_size_ == 0)
+        return 0;
+    return (tail_ + buffer_size_ - head_) % buffer_size_;
+}
+
+// @brief Advances by one control period and evaluates the Hermite spline of
+// the current segment:
+//   p(s) = h00(s) p0 + h10(s) T v0 + h01(s) p1 + h11(s) T v1,  s = t / T
+// @returns false if the queue ran empty. The axis then holds the last point
+// at zero velocity, and resumes from there when new points arrive.
+bool PvtFifo::update(Step_t* step) {
+    elapsed_ += current_meas_period;
+
+    uint32_t head = head_;
+    while (head != tail_ && elapsed_ >= buffer_[head].dt) {
+        elapsed_ -= buffer_[head].dt;
+        start_pos_ = buffer_[head].pos;
+        start_vel_ = buffer_[head].vel;
+        head = (head + 1) % buffer_size_;
+        head_ = head;
+    }
+
+    if (head == tail_) {
+        if (!underrun_)
+            ++underrun_count_;
+        underrun_ = true;
+        start_vel_ = 0.0f;
+        elapsed_ = 0.0f;
+        *step = { start_pos_, 0.0f, 0.0f };
+        return false;
+    }
+    underrun_ = false;
+
+    const Point_t& end = buffer_[head];
+    float T = end.dt;
+    float s = elapsed_ / T;
+    float s2 = s * s;
+    float s3 = s2 * s;
+    float m0 = T * start_vel_;
+    float m1 = T * end.vel;
+    float dp = end.pos - start_pos_;
+
+    step->pos = start_pos_ + (s3 - 2.0f * s2 + s) * m0 + (-2.0f * s3 + 3.0f * s2) * dp + (s3 - s2) * m1;
+    step->vel = ((3.0f * s2 - 4.0f * s + 1.0f) * m0 + (-6.0f * s2 + 6.0f * s) * dp + (3.0f * s2 - 2.0f * s) * m1) / T;
+    step->acc = ((6.0f * s - 4.0f) * m0 + (-12.0f * s + 6.0f) * dp + (6.0f * s - 2.0f) * m1) / (T * T);
+    return true;
+}
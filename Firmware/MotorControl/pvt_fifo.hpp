@@ -0,0 +1,73 @@
+#ifndef __PVT_FIFO_HPP
+#define __PVT_FIFO_HPP
+
+#ifndef __ODRIVE_MAIN_H
+#error "This file should not be included directly. Include odrive_main.h instead."
+#endif
+
+// @brief Queue of streamed (position, velocity, time) points, interpolated
+// with cubic Hermite splines at the control rate.
+// Points are pushed by the communication thread and consumed by the control
+// loop; as there is exactly one of each, the ring buffer needs no locking.
+class PvtFifo {
+public:
+    struct Config_t {
+        uint32_t depth = 32;         // number of points the queue can hold, allocated at startup
+        uint32_t low_watermark = 8;  // raise EVENT_PVT_LOW_WATERMARK when the queue drains to this many points
+    };
+
+    struct Point_t {
+        float pos;  // [counts]
+        float vel;  // [counts/s]
+        float dt;   // [s] time from the previous point to this one
+    };
+
+    struct Step_t {
+        float pos;  // [counts]
+        float vel;  // [counts/s]
+        float acc;  // [counts/s^2]
+    };
+
+    static constexpr uint32_t kMaxDepth = 1024;
+
+    explicit PvtFifo(Config_t& config);
+
+    bool push(float pos, float vel, float dt);
+    void clear();
+    void start(float pos, float vel);
+    bool update(Step_t* step);
+    uint32_t get_count();
+
+    Config_t& config_;
+
+    // Ring buffer with one unused slot to tell full from empty,
+    // allocated once by the constructor
+    Point_t* buffer_ = nullptr;
+    uint32_t buffer_size_ = 0;
+    volatile uint32_t head_ = 0;  // next point to reach, owned by the control loop
+    volatile uint32_t tail_ = 0;  // next free slot, owned by push()
+
+    // Segment from the last reached point to the point at head_
+    float start_pos_ = 0.0f;  // [counts]
+    float start_vel_ = 0.0f;  // [counts/s]
+    float elapsed_ = 0.0f;    // [s]
+    bool underrun_ = false;
+    uint32_t underrun_count_ = 0;
+
+    // Communication protocol definitions
+    auto make_protocol_definitions() {
+        return make_protocol_member_list(
+            make_protocol_ro_property("underrun", &underrun_),
+            make_protocol_ro_property("underrun_count", &underrun_count_),
+            make_protocol_object("config",
+                make_protocol_property("depth", &config_.depth),
+                make_protocol_property("low_watermark", &config_.low_watermark)
+            ),
+            make_protocol_function("push", *this, &PvtFifo::push, "pos", "vel", "dt"),
+            make_protocol_function("clear", *this, &PvtFifo::clear),
+            make_protocol_function("get_count", *this, &PvtFifo::get_count)
+        );
+    }
+};
+
+#endif // __PVT_FIFO_HPP
@@ -0,0 +1,78 @@
+
+#include <algorithm>
+
+#include "odrive_main.h"
+
+RepetitiveController::RepetitiveController(Config_t& config) :
+    config_(config)
+{}
+
+// @brief Restarts the phase tracking without forgetting the learned table.
+void RepetitiveController::reset() {
+    time_ = 0.0f;
+    bin_ = -1;
+    error_sum_ = 0.0f;
+    error_count_ = 0;
+    current_ = 0.0f;
+}
+
+// @brief Forgets the learned table.
+void RepetitiveController::clear() {
+    for (size_t i = 0; i < kTableSize; ++i)
+        table_[i] = 0.0f;
+    reset();
+}
+
+// @brief Runs one control tick.
+// The velocity error is averaged over each bin. When the phase leaves a bin,
+// the entry phase_lead bins before it is updated as
+//   u(k) = Q(u)(k) + learning_gain * e(k + phase_lead)
+// where Q is a zero-phase 3-tap low pass that keeps the learning from
+// building up at frequencies the loop cannot follow.
+// "Before" is in the direction of travel, so in INDEX_POSITION mode the
+// lead follows the sign of vel_estimate.
+// @returns the feed-forward current for the current phase [A]
+float RepetitiveController::update(float pos_estimate, float vel_estimate, float vel_error) {
+    if (!config_.enabled || !(config_.period > 0.0f)) {
+        reset();
+        return 0.0f;
+    }
+
+    float phase;
+    if (config_.index_mode == INDEX_TIME) {
+        time_ += current_meas_period;
+        if (time_ >= config_.period)
+            time_ -= config_.period;
+        phase = time_;
+    } else {
+        phase = fmodf_pos(pos_estimate, config_.period);
+    }
+
+    int32_t bin = static_cast<int32_t>(phase * (static_cast<float>(kTableSize) / config_.period));
+    if (bin >= (int32_t)kTableSize)
+        bin = kTableSize - 1;
+
+    if (bin != bin_) {
+        if (bin_ >= 0 && error_count_ > 0 && config_.learning_gain != 0.0f) {
+            int32_t phase_lead = config_.phase_lead;
+            if (config_.index_mode == INDEX_POSITION && vel_estimate < 0.0f)
+                phase_lead = -phase_lead;
+            size_t k = mod(bin_ - phase_lead, (int)kTableSize);
+            size_t k_prev = (k + kTableSize - 1) % kTableSize;
+            size_t k_next = (k + 1) % kTableSize;
+            float q = config_.q_filter;
+            float filtered = q * (table_[k_prev] + table_[k_next]) + (1.0f - 2.0f * q) * table_[k];
+            float learned = filtered + config_.learning_gain * (error_sum_ / (float)error_count_);
+            table_[k] = std::max(-config_.max_current, std::min(learned, config_.max_current));
+        }
+        bin_ = bin;
+        error_sum_ = 0.0f;
+        error_count_ = 0;
+    }
+
+    error_sum_ += vel_error;
+    ++error_count_;
+
+    current_ = table_[bin];
+    return current_;
+}
@@ -0,0 +1,65 @@
+#ifndef __REPETITIVE_CONTROL_HPP
+#define __REPETITIVE_CONTROL_HPP
+
+#ifndef __ODRIVE_MAIN_H
+#error "This file should not be included directly. Include odrive_main.h instead."
+#endif
+
+// @brief Learns a current feed-forward table for motion that repeats with a
+// fixed period in position or time, from the velocity error of past cycles.
+// The table is kept when the motor is disarmed, so learning carries over
+// between runs until clear() is called.
+class RepetitiveController {
+public:
+    enum IndexMode_t {
+        INDEX_POSITION = 0, // period is in [counts] of the encoder position
+        INDEX_TIME = 1,     // period is in [s] since the controller was armed
+    };
+
+    struct Config_t {
+        bool enabled = false;
+        IndexMode_t index_mode = INDEX_POSITION;
+        float period = 8192.0f;      // [counts] or [s], depending on index_mode
+        float learning_gain = 0.0f;  // [A/(counts/s)] 0.0f to freeze the table
+        float q_filter = 0.25f;      // weight of each neighbour in the 3-tap Q filter, 0.0f for no filtering
+        int32_t phase_lead = 1;      // [bins] learn from this many bins ahead, to compensate the loop delay
+        float max_current = 5.0f;    // [A] bound on each table entry
+    };
+
+    static constexpr size_t kTableSize = 128;
+
+    explicit RepetitiveController(Config_t& config);
+
+    void reset();
+    void clear();
+    float update(float pos_estimate, float vel_estimate, float vel_error);
+
+    Config_t& config_;
+
+    float table_[kTableSize] = { 0.0f }; // [A]
+    float time_ = 0.0f;                  // [s] phase in INDEX_TIME mode
+    int32_t bin_ = -1;                   // bin of the previous update, -1 after reset
+    float error_sum_ = 0.0f;             // [counts/s] accumulated over the current bin
+    uint32_t error_count_ = 0;
+    float current_ = 0.0f;               // [A] last output
+
+    // Communication protocol definitions
+    auto make_protocol_definitions() {
+        return make_protocol_member_list(
+            make_protocol_ro_property("current", &current_),
+            make_protocol_ro_property("bin", &bin_),
+            make_protocol_object("config",
+                make_protocol_property("enabled", &config_.enabled),
+                make_protocol_property("index_mode", &config_.index_mode),
+                make_protocol_property("period", &config_.period),
+                make_protocol_property("learning_gain", &config_.learning_gain),
+                make_protocol_property("q_filter", &config_.q_filter),
+                make_protocol_property("phase_lead", &config_.phase_lead),
+                make_protocol_property("max_current", &config_.max_current)
+            ),
+            make_protocol_function("clear", *this, &RepetitiveController::clear)
+        );
+    }
+};
+
+#endif // __REPETITIVE_CONTROL_HPP
@@ -0,0 +1,157 @@
+#include <math.h>
+#include "odrive_main.h"
+#include "utils.h"
+
+// Symbol                     Description
+// Xi and Vi                  Initial position and velocity (acceleration is 0)
+// Xf                         Position set-point
+// s                          Direction (sign) of the trajectory
+// Vmax, Amax, Dmax and Jmax  Kinematic bounds
+// Vr                         Reached (cruise) velocity
+// Tj, Tc                     Duration of the jerk and constant acceleration
+//                            stages of a velocity change
+
+// A sign function where input 0 has positive sign (not 0)
+static float sign_hard(float val) {
+    return (std::signbit(val)) ? -1.0f : 1.0f;
+}
+
+// Jerk limited change of velocity from v0 to v1, starting and ending at zero
+// acceleration: jerk for Tj, constant acceleration for Tc, -jerk for Tj.
+struct VelocityChange_t {
+    float Tj;
+    float Tc;
+    float jerk;  // signed
+    float T;     // total duration
+    float dist;  // displacement
+};
+
+static VelocityChange_t plan_velocity_change(float v0, float v1, float Amax, float Jmax) {
+    VelocityChange_t change;
+    float dv = v1 - v0;
+    float abs_dv = fabsf(dv);
+    if (abs_dv * Jmax >= SQ(Amax)) {
+        // Acceleration limit is reached
+        change.Tj = Amax / Jmax;
+        change.Tc = abs_dv / Amax - change.Tj;
+    } else {
+        change.Tj = sqrtf(abs_dv / Jmax);
+        change.Tc = 0.0f;
+    }
+    change.jerk = std::copysign(Jmax, dv);
+    change.T = 2.0f * change.Tj + change.Tc;
+    // The acceleration profile is symmetric, so the mean velocity is the average
+    change.dist = 0.5f * (v0 + v1) * change.T;
+    return change;
+}
+
+SCurveTrajectory::SCurveTrajectory(TrapezoidalTrajectory::Config_t& config) : config_(config) {}
+
+// @brief Plans the move. Called from the communication thread, so the
+// bisection for short moves is not in the control loop.
+bool SCurveTrajectory::planSCurve(float Xf, float Xi, float Vi,
+                                  float Vmax, float Amax, float Dmax, float Jmax) {
+    if (!(Vmax > 0.0f && Amax > 0.0f && Dmax > 0.0f && Jmax > 0.0f))
+        return false;
+
+    float dX = Xf - Xi;  // Distance to travel
+    float dXstop = plan_velocity_change(Vi, 0.0f, Dmax, Jmax).dist; // Minimum stopping displacement
+    float s = sign_hard(dX - dXstop); // Sign of coast velocity (if any)
+    float Vi_s = s * Vi; // Initial velocity in the direction of the move
+
+    // Acceleration bound of the change from Vi to Vr: Dmax when slowing
+    // down (so that Vr = 0 plans exactly the stop of dXstop), Amax when
+    // speeding up, and both when reversing, which slows down first
+    auto first_change_limit = [&](float Vr) {
+        if (Vi_s < 0.0f)
+            return std::min(Amax, Dmax);
+        return (s * Vr < Vi_s) ? Dmax : Amax;
+    };
+
+    // Displacement of changing from Vi to Vr and decelerating from Vr to 0
+    auto displacement = [&](float Vr) {
+        return plan_velocity_change(Vi, Vr, first_change_limit(Vr), Jmax).dist
+             + plan_velocity_change(Vr, 0.0f, Dmax, Jmax).dist;
+    };
+
+    // Are we displacing enough to reach cruising speed?
+    float Vr = s * Vmax;
+    if (s * dX < s * displacement(Vr)) {
+        if (Vi_s >= Vmax) {
+            // Already at or above cruising speed: keep Vi and coast
+            Vr = Vi;
+        } else {
+            // Short move. Slowing down to some Vr below Vi and then stopping
+            // goes further than stopping right away, because of the extra jerk
+            // stages, so the displacement isn't monotonic below Vi and has a
+            // cusp at Vi. From max(Vi, 0) up it grows monotonically, starting
+            // at no more than dX (the stopping displacement for Vi_s >= 0, a
+            // reversal otherwise), so bisect there.
+            float lo = std::max(Vi_s, 0.0f);
+            float hi = Vmax;
+            for (int i = 0; i < 24; ++i) {
+                float mid = 0.5f * (lo + hi);
+                if (s * displacement(s * mid) > s * dX)
+                    hi = mid;
+                else
+                    lo = mid;
+            }
+            Vr = s * lo;
+        }
+    }
+
+    VelocityChange_t accel = plan_velocity_change(Vi, Vr, first_change_limit(Vr), Jmax);
+    VelocityChange_t decel = plan_velocity_change(Vr, 0.0f, Dmax, Jmax);
+    // Coast for whatever distance is left (only a bisection residual for short moves)
+    float Tv = 0.0f;
+    if (fabsf(Vr) > 0.0f)
+        Tv = std::max(0.0f, (dX - accel.dist - decel.dist) / Vr);
+
+    float durations[kNumSegments] = { accel.Tj, accel.Tc, accel.Tj, Tv, decel.Tj, decel.Tc, decel.Tj };
+    float jerks[kNumSegments] = { accel.jerk, 0.0f, -accel.jerk, 0.0f, decel.jerk, 0.0f, -decel.jerk };
+
+    // Integrate the state at the start of each segment
+    float t = 0.0f, x = Xi, v = Vi, a = 0.0f;
+    for (size_t k = 0; k < kNumSegments; ++k) {
+        float T = durations[k];
+        float j = jerks[k];
+        t_[k] = t;
+        x_[k] = x;
+        v_[k] = v;
+        a_[k] = a;
+        j_[k] = j;
+        x += (v + (0.5f * a + (1.0f / 6.0f) * j * T) * T) * T;
+        v += (a + 0.5f * j * T) * T;
+        a += j * T;
+        t += T;
+    }
+    t_[kNumSegments] = t;
+
+    Tf_ = t;
+    Vr_ = Vr;
+    Xf_ = Xf;
+    return true;
+}
+
+SCurveTrajectory::Step_t SCurveTrajectory::eval(float t) {
+    Step_t trajStep;
+    if (t < 0.0f) {  // Initial Condition
+        trajStep.Y   = x_[0];
+        trajStep.Yd  = v_[0];
+        trajStep.Ydd = 0.0f;
+    } else if (t < Tf_) {
+        size_t k = 0;
+        while (k + 1 < kNumSegments && t >= t_[k + 1])
+            ++k;
+        float dt = t - t_[k];
+        float j = j_[k];
+        trajStep.Y   = x_[k] + (v_[k] + (0.5f * a_[k] + (1.0f / 6.0f) * j * dt) * dt) * dt;
+        trajStep.Yd  = v_[k] + (a_[k] + 0.5f * j * dt) * dt;
+        trajStep.Ydd = a_[k] + j * dt;
+    } else {  // Final Condition
+        trajStep.Y   = Xf_;
+        trajStep.Yd  = 0.0f;
+        trajStep.Ydd = 0.0f;
+    }
+    return trajStep;
+}
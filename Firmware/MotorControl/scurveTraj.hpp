@@ -0,0 +1,34 @@
+#ifndef _SCURVE_TRAJ_H
+#define _SCURVE_TRAJ_H
+
+// @brief Jerk limited (7 segment) point to point trajectory.
+// Shares the kinematic limits of the trapezoidal planner, and is used
+// instead of it by move_to_pos when trap_traj.config.jerk_limit is set.
+class SCurveTrajectory {
+public:
+    typedef TrapezoidalTrajectory::Step_t Step_t;
+
+    static constexpr size_t kNumSegments = 7;
+
+    explicit SCurveTrajectory(TrapezoidalTrajectory::Config_t& config);
+    bool planSCurve(float Xf, float Xi, float Vi,
+                    float Vmax, float Amax, float Dmax, float Jmax);
+    Step_t eval(float t);
+
+    Axis* axis_ = nullptr;  // set by Axis constructor
+    TrapezoidalTrajectory::Config_t& config_;
+
+    float Xf_ = 0.0f;
+    float Vr_ = 0.0f;
+    float Tf_ = 0.0f;
+
+    // Segment k starts at time t_[k] in state (x_[k], v_[k], a_[k]) and
+    // has constant jerk j_[k]. t_[kNumSegments] is the end of the move.
+    float t_[kNumSegments + 1] = { 0.0f };
+    float x_[kNumSegments] = { 0.0f };
+    float v_[kNumSegments] = { 0.0f };
+    float a_[kNumSegments] = { 0.0f };
+    float j_[kNumSegments] = { 0.0f };
+};
+
+#endif
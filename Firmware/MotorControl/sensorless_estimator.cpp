@@ -26,7 +26,7 @@ bool SensorlessEstimator::update() {
     float eta[2];
     for (int i = 0; i <= 1; ++i) {
         // y is the total flux-driving voltage (see paper eqn 4)
-        float y = -axis_->motor_.config_.phase_resistance * I_alpha_beta[i] + V_alpha_beta_memory_[i];
+        float y = -axis_->motor_.phase_resistance() * I_alpha_beta[i] + V_alpha_beta_memory_[i];
         // flux dynamics (prediction)
         float x_dot = y;
         // integrate prediction to current timestep
@@ -0,0 +1,149 @@
+
+#include "tests.hpp"
+
+// Lightly damped load, coupled to the motor by a spring and a damper:
+//   x'' = wn^2 (x_motor - x) + 2 zeta wn (v_motor - v)
+// The motor is assumed to follow the (shaped) commands exactly.
+struct ResonantLoad {
+    float wn;
+    float zeta;
+    float x = 0.0f;
+    float v = 0.0f;
+
+    void step(float x_motor, float v_motor, float dt) {
+        const int substeps = 10;
+        float h = dt / substeps;
+        for (int i = 0; i < substeps; ++i) {
+            float a = SQ(wn) * (x_motor - x) + 2.0f * zeta * wn * (v_motor - v);
+            v += a * h;
+            x += v * h;
+        }
+    }
+};
+
+// @brief Runs a trapezoidal move through the shaper into the load.
+// @returns the time from the end of the unshaped move until the load stays
+// within tolerance of the target [s]
+static float settling_time(InputShaper::Config_t shaper_config, float load_frequency) {
+    const float Xf = 10000.0f;    // [counts]
+    const float tolerance = 1.0f; // [counts]
+    const float duration = 2.0f;  // [s]
+
+    TrapezoidalTrajectory::Config_t traj_config;
+    TrapezoidalTrajectory traj(traj_config);
+    traj.planTrapezoidal(Xf, 0.0f, 0.0f, 20000.0f, 200000.0f, 200000.0f);
+
+    InputShaper shaper(shaper_config);
+    shaper.setup();
+    ResonantLoad load = { 2.0f * M_PI * load_frequency, 0.05f };
+
+    float last_outside = 0.0f;
+    for (int i = 0; i * current_meas_period < traj.Tf_ + duration; ++i) {
+        float t = i * current_meas_period;
+        TrapezoidalTrajectory::Step_t traj_step = (t < traj.Tf_) ? traj.eval(t) : TrapezoidalTrajectory::Step_t{ Xf, 0.0f, 0.0f };
+        InputShaper::Sample_t cmd = shaper.process({ traj_step.Y, traj_step.Yd, 0.0f });
+        load.step(cmd.pos, cmd.vel, current_meas_period);
+        if (fabsf(load.x - Xf) > tolerance)
+            last_outside = t;
+    }
+    return last_outside - traj.Tf_;
+}
+
+static bool settling_benchmark() {
+    const float f = 20.0f; // [Hz]
+    const struct {
+        const char* name;
+        InputShaper::Type_t type;
+    } types[] = {
+        { "none", InputShaper::TYPE_NONE },
+        { "ZV", InputShaper::TYPE_ZV },
+        { "ZVD", InputShaper::TYPE_ZVD },
+        { "EI", InputShaper::TYPE_EI },
+    };
+
+    printf("settling time after the move [ms], load at 20Hz, zeta 0.05\n");
+    printf("shaper | f_load = f | f_load = 1.1 f\n");
+    float unshaped[2] = { 0.0f, 0.0f };
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i) {
+        InputShaper::Config_t config = { types[i].type, f, 0.05f };
+        float nominal = settling_time(config, f);
+        float detuned = settling_time(config, 1.1f * f);
+        printf("%6s | %10.1f | %14.1f\n", types[i].name, 1000.0f * nominal, 1000.0f * detuned);
+
+        if (types[i].type == InputShaper::TYPE_NONE) {
+            unshaped[0] = nominal;
+            unshaped[1] = detuned;
+            continue;
+        }
+        // Once tuned the shaper removes the vibration, and the settling
+        // time is down to about its own delay
+        TEST_CHECK(nominal < 0.25f * unshaped[0]);
+        if (types[i].type != InputShaper::TYPE_ZV) {
+            // ZVD and EI are meant to be robust to a mistuned frequency
+            TEST_CHECK(detuned < 0.5f * unshaped[1]);
+        }
+    }
+    return true;
+}
+
+static bool impulse_train_test() {
+    const InputShaper::Type_t types[] = { InputShaper::TYPE_ZV, InputShaper::TYPE_ZVD, InputShaper::TYPE_EI };
+    for (InputShaper::Type_t type : types) {
+        InputShaper::Config_t config = { type, 20.0f, 0.05f };
+        InputShaper shaper(config);
+        TEST_CHECK(shaper.setup());
+        TEST_CHECK(shaper.active_);
+
+        // Unity gain, so the shaped move ends at the target
+        float sum = 0.0f;
+        for (size_t i = 0; i < shaper.num_impulses_; ++i)
+            sum += shaper.amplitudes_[i];
+        TEST_CHECK(fabsf(sum - 1.0f) < 1e-6f);
+
+        // Starts from a steady state, not from zero
+        InputShaper::Sample_t out = shaper.process({ 5.0f, 0.0f, 1.0f });
+        TEST_CHECK(fabsf(out.pos - 5.0f) < 1e-5f && fabsf(out.current - 1.0f) < 1e-6f);
+    }
+    return true;
+}
+
+static bool buffer_bound_test() {
+    // No buffer for a disabled shaper, which passes the commands through
+    InputShaper::Config_t config = { InputShaper::TYPE_NONE, 20.0f, 0.05f };
+    InputShaper none(config);
+    TEST_CHECK(none.buffer_ == nullptr);
+    TEST_CHECK(none.setup() && !none.active_);
+    InputShaper::Sample_t out = none.process({ 1.0f, 2.0f, 3.0f });
+    TEST_CHECK(out.pos == 1.0f && out.vel == 2.0f && out.current == 3.0f);
+
+    // Enabling it later needs a buffer allocated at startup
+    config.type = InputShaper::TYPE_ZV;
+    TEST_CHECK(!none.setup() && !none.active_);
+
+    // The buffer fits the startup config, a longer delay is refused...
+    InputShaper zv(config);
+    TEST_CHECK(zv.buffer_size_ == 201);
+    config.type = InputShaper::TYPE_ZVD;
+    TEST_CHECK(!zv.setup() && !zv.active_);
+    // ...a shorter one is accepted
+    config.frequency = 40.0f;
+    TEST_CHECK(zv.setup() && zv.active_);
+
+    // The buffer size is bounded
+    InputShaper::Config_t low_config = { InputShaper::TYPE_ZVD, 1.0f, 0.05f };
+    InputShaper low(low_config);
+    TEST_CHECK(low.buffer_ == nullptr);
+    TEST_CHECK(!low.setup());
+
+    // Invalid parameters are refused
+    InputShaper::Config_t bad_config = { InputShaper::TYPE_ZV, 20.0f, 1.5f };
+    InputShaper bad(bad_config);
+    TEST_CHECK(!bad.setup());
+    return true;
+}
+
+bool input_shaper_test() {
+    return impulse_train_test()
+        && buffer_bound_test()
+        && settling_benchmark();
+}
@@ -0,0 +1,78 @@
+
+#include "tests.hpp"
+
+// Velocity loop (P only, with a delay of a few ticks, e.g. from the current
+// loop) around an inertia with a load torque that repeats every period, in
+// position or in time. The phase lead matches the delay; with the lead in the
+// wrong direction the learning diverges.
+// Runs for the given number of periods with learning and returns the RMS
+// velocity error over the first and the last period [counts/s].
+static void run_periodic_disturbance(RepetitiveController::IndexMode_t index_mode,
+        float vel_cmd, int periods, float* rms_first, float* rms_last) {
+    const float accel_per_amp = 100000.0f; // [counts/s^2/A]
+    const float vel_gain = 5e-3f;          // [A/(counts/s)]
+    const int delay_ticks = 4;
+
+    RepetitiveController::Config_t config;
+    config.enabled = true;
+    config.index_mode = index_mode;
+    config.period = (index_mode == RepetitiveController::INDEX_POSITION) ? 8192.0f : 0.2f;
+    config.learning_gain = 0.5f * vel_gain;
+    config.phase_lead = 2;
+    RepetitiveController rc(config);
+
+    // Load torque, as the current that balances it [A]
+    auto disturbance = [&](float pos, float t) {
+        float phase = (index_mode == RepetitiveController::INDEX_POSITION) ? pos : t;
+        float x = 2.0f * M_PI * phase / config.period;
+        return 0.5f * sinf(3.0f * x) + 0.2f * sinf(7.0f * x + 1.0f);
+    };
+
+    float period_ticks = (index_mode == RepetitiveController::INDEX_POSITION)
+            ? config.period / fabsf(vel_cmd) * current_meas_hz
+            : config.period * current_meas_hz;
+    int ticks = static_cast<int>(periods * period_ticks);
+
+    float pos = 0.0f;
+    float vel = vel_cmd;
+    float Iq_delayed[delay_ticks] = { 0.0f };
+    float sum_sq_first = 0.0f;
+    float sum_sq_last = 0.0f;
+    for (int i = 0; i < ticks; ++i) {
+        float t = i * current_meas_period;
+        float v_err = vel_cmd - vel;
+        float Iq = vel_gain * v_err + rc.update(pos, vel, v_err);
+
+        vel += (Iq_delayed[i % delay_ticks] - disturbance(pos, t)) * accel_per_amp * current_meas_period;
+        pos += vel * current_meas_period;
+        Iq_delayed[i % delay_ticks] = Iq;
+
+        if (i < period_ticks)
+            sum_sq_first += SQ(v_err);
+        if (i >= ticks - period_ticks)
+            sum_sq_last += SQ(v_err);
+    }
+    *rms_first = sqrtf(sum_sq_first / period_ticks);
+    *rms_last = sqrtf(sum_sq_last / period_ticks);
+}
+
+bool repetitive_control_test() {
+    const struct {
+        const char* name;
+        RepetitiveController::IndexMode_t index_mode;
+        float vel_cmd; // [counts/s]
+    } cases[] = {
+        { "position, forward", RepetitiveController::INDEX_POSITION, 40960.0f },
+        { "position, backward", RepetitiveController::INDEX_POSITION, -40960.0f },
+        { "time", RepetitiveController::INDEX_TIME, 40960.0f },
+    };
+
+    printf("RMS velocity error [counts/s] | first period | after 50 periods\n");
+    for (auto& c : cases) {
+        float rms_first, rms_last;
+        run_periodic_disturbance(c.index_mode, c.vel_cmd, 50, &rms_first, &rms_last);
+        printf("%29s | %12.1f | %16.1f\n", c.name, rms_first, rms_last);
+        TEST_CHECK(rms_last < 0.1f * rms_first);
+    }
+    return true;
+}
@@ -0,0 +1,28 @@
+
+#include "tests.hpp"
+
+// Implemented in utils.c, which also contains target specific code
+extern "C" int mod(int dividend, int divisor) {
+    int r = dividend % divisor;
+    return (r < 0) ? (r + divisor) : r;
+}
+
+int main(void) {
+    struct {
+        const char* name;
+        bool (*run)();
+    } tests[] = {
+        { "input_shaper", input_shaper_test },
+        { "repetitive_control", repetitive_control_test },
+        { "scurve", scurve_test },
+    };
+
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+        printf("--- %s\n", tests[i].name);
+        bool ok = tests[i].run();
+        printf("%s %s\n", ok ? "PASSED" : "FAILED", tests[i].name);
+        failed += ok ? 0 : 1;
+    }
+    return failed ? 1 : 0;
+}
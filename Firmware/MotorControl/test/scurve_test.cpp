@@ -0,0 +1,173 @@
+
+#include "tests.hpp"
+
+// Samples the planned trajectory and checks it against the kinematic bounds,
+// the continuity of its derivatives and the end point.
+static bool check_profile(SCurveTrajectory& traj, float Xf, float Xi, float Vi,
+                          float Vmax, float Amax, float Dmax, float Jmax) {
+    const float dt = 1e-4f;
+    const float tol = 1e-3f;
+    TEST_CHECK(traj.Tf_ > 0.0f);
+
+    // Starts at the initial state
+    SCurveTrajectory::Step_t step = traj.eval(0.0f);
+    TEST_CHECK(fabsf(step.Y - Xi) < tol * (1.0f + fabsf(Xi)));
+    TEST_CHECK(fabsf(step.Yd - Vi) < tol * (1.0f + fabsf(Vi)));
+    TEST_CHECK(fabsf(step.Ydd) < tol);
+
+    float v_bound = std::max(Vmax, fabsf(Vi)) * (1.0f + tol);
+    float a_bound = std::max(Amax, Dmax) * (1.0f + tol);
+    SCurveTrajectory::Step_t prev = step;
+    float t_prev = 0.0f;
+    float x_range = std::max(fabsf(Xi), fabsf(Xf));
+    for (int i = 1; i * dt < traj.Tf_; ++i) {
+        float t = i * dt;
+        float h = t - t_prev;
+        step = traj.eval(t);
+        TEST_CHECK(fabsf(step.Yd) <= v_bound);
+        TEST_CHECK(fabsf(step.Ydd) <= a_bound);
+        // Continuous position, velocity and acceleration, bounded jerk
+        // (within the float resolution of t, about 1% of dt late in long moves)
+        TEST_CHECK(fabsf(step.Ydd - prev.Ydd) <= Jmax * h * 1.02f + tol);
+        TEST_CHECK(fabsf(step.Yd - prev.Yd) <= a_bound * h * 1.02f + tol);
+        TEST_CHECK(fabsf(step.Y - prev.Y) <= v_bound * h * 1.02f + tol);
+        prev = step;
+        t_prev = t;
+        x_range = std::max(x_range, fabsf(step.Y));
+    }
+
+    // Ends at rest on the set-point, without a jump to the final condition
+    float Tf = traj.t_[SCurveTrajectory::kNumSegments];
+    float T = Tf - traj.t_[SCurveTrajectory::kNumSegments - 1];
+    size_t k = SCurveTrajectory::kNumSegments - 1;
+    float x_end = traj.x_[k] + (traj.v_[k] + (0.5f * traj.a_[k] + (1.0f / 6.0f) * traj.j_[k] * T) * T) * T;
+    float v_end = traj.v_[k] + (traj.a_[k] + 0.5f * traj.j_[k] * T) * T;
+    float a_end = traj.a_[k] + traj.j_[k] * T;
+    // (float resolution over the positions the profile passes through)
+    TEST_CHECK(fabsf(x_end - Xf) < 0.01f + 1e-5f * x_range);
+    TEST_CHECK(fabsf(v_end) < 0.1f);
+    TEST_CHECK(fabsf(a_end) < 1.0f);
+    return true;
+}
+
+// Long move from rest: accelerates to Vmax at Amax, cruises, decelerates
+//   T_change = Vmax / A + A / J, dist_change = Vmax * T_change / 2
+//   Tf = T_accel + T_decel + (dX - dist_accel - dist_decel) / Vmax
+static bool long_move_test() {
+    TrapezoidalTrajectory::Config_t config;
+    SCurveTrajectory traj(config);
+    float Vmax = 20000.0f, Amax = 50000.0f, Dmax = 25000.0f, Jmax = 500000.0f;
+    float dX = 50000.0f;
+    TEST_CHECK(traj.planSCurve(dX, 0.0f, 0.0f, Vmax, Amax, Dmax, Jmax));
+
+    float Ta = Vmax / Amax + Amax / Jmax;
+    float Td = Vmax / Dmax + Dmax / Jmax;
+    float Tv = (dX - 0.5f * Vmax * (Ta + Td)) / Vmax;
+    TEST_CHECK(fabsf(traj.Tf_ - (Ta + Tv + Td)) < 1e-4f);
+    TEST_CHECK(fabsf(traj.Vr_ - Vmax) < 1e-3f);
+    TEST_CHECK(fabsf(traj.eval(Ta + 0.5f * Tv).Yd - Vmax) < 1e-2f);
+
+    // Backwards too
+    TEST_CHECK(traj.planSCurve(-dX, 0.0f, 0.0f, Vmax, Amax, Dmax, Jmax));
+    TEST_CHECK(fabsf(traj.Tf_ - (Ta + Tv + Td)) < 1e-4f);
+    return check_profile(traj, -dX, 0.0f, 0.0f, Vmax, Amax, Dmax, Jmax);
+}
+
+// Short move from rest that reaches neither Amax nor Vmax: four jerk stages
+//   dX = 2 Vr^(3/2) / sqrt(J), Tf = 4 sqrt(Vr / J)
+static bool short_move_test() {
+    TrapezoidalTrajectory::Config_t config;
+    SCurveTrajectory traj(config);
+    float Vmax = 20000.0f, Amax = 1e6f, Dmax = 1e6f, Jmax = 100000.0f;
+    float dX = 1000.0f;
+    TEST_CHECK(traj.planSCurve(dX, 0.0f, 0.0f, Vmax, Amax, Dmax, Jmax));
+
+    float Vr = powf(0.5f * dX * sqrtf(Jmax), 2.0f / 3.0f);
+    TEST_CHECK(fabsf(traj.Vr_ - Vr) < 1e-3f * Vr);
+    TEST_CHECK(fabsf(traj.Tf_ - 4.0f * sqrtf(Vr / Jmax)) < 1e-4f);
+    return check_profile(traj, dX, 0.0f, 0.0f, Vmax, Amax, Dmax, Jmax);
+}
+
+// Moving towards the goal: the reached velocity must not drop below Vi.
+// Vi = 2000, A = D = J = 5000: stopping right away takes 1.265s over 1265
+// counts. Coasting at Vi for the rest is the slowest acceptable plan.
+static bool initial_velocity_test() {
+    TrapezoidalTrajectory::Config_t config;
+    SCurveTrajectory traj(config);
+    float Vi = 2000.0f, Vmax = 10000.0f, A = 5000.0f, J = 5000.0f;
+    float T_stop = 2.0f * sqrtf(Vi / J);
+    float dX_stop = 0.5f * Vi * T_stop;
+
+    const float dXs[] = { 1300.0f, 1850.0f, 3000.0f };
+    for (float dX : dXs) {
+        TEST_CHECK(traj.planSCurve(dX, 0.0f, Vi, Vmax, A, A, J));
+        float T_coast = T_stop + (dX - dX_stop) / Vi;
+        TEST_CHECK(traj.Vr_ >= Vi);
+        TEST_CHECK(traj.Tf_ <= T_coast + 1e-4f);
+        if (!check_profile(traj, dX, 0.0f, Vi, Vmax, A, A, J))
+            return false;
+    }
+
+    // Exactly the stopping distance: just stop
+    TEST_CHECK(traj.planSCurve(dX_stop, 0.0f, Vi, Vmax, A, A, J));
+    TEST_CHECK(fabsf(traj.Tf_ - T_stop) < 1e-3f);
+
+    // With Dmax < Amax, stopping uses Dmax, consistently with the direction
+    // decision, so a goal just past the stopping point is still reached forwards
+    // (Vi * J >= D^2, so the stop reaches D)
+    float D = 2500.0f;
+    float dX = 0.5f * Vi * (Vi / D + D / J) + 1.0f;
+    TEST_CHECK(traj.planSCurve(dX, 0.0f, Vi, Vmax, A, D, J));
+    TEST_CHECK(traj.Vr_ >= Vi);
+    return check_profile(traj, dX, 0.0f, Vi, Vmax, A, D, J);
+}
+
+// Moving away from the goal, or too fast
+static bool reversal_and_overspeed_test() {
+    TrapezoidalTrajectory::Config_t config;
+    SCurveTrajectory traj(config);
+    float Vmax = 2000.0f, A = 5000.0f, D = 8000.0f, J = 20000.0f;
+
+    const float dXs[] = { -200.0f, 100.0f, 2000.0f, 20000.0f };
+    for (float dX : dXs) {
+        TEST_CHECK(traj.planSCurve(dX, 0.0f, -1000.0f, Vmax, A, D, J));
+        if (!check_profile(traj, dX, 0.0f, -1000.0f, Vmax, A, D, J))
+            return false;
+        TEST_CHECK(traj.planSCurve(dX, 0.0f, 3000.0f, Vmax, A, D, J));
+        if (!check_profile(traj, dX, 0.0f, 3000.0f, Vmax, A, D, J))
+            return false;
+    }
+    return true;
+}
+
+// Random moves: all must meet the bounds and end on the set-point
+static bool random_move_test() {
+    TrapezoidalTrajectory::Config_t config;
+    SCurveTrajectory traj(config);
+    srand(1);
+    auto uniform = [](float lo, float hi) {
+        return lo + (hi - lo) * (float)rand() / (float)RAND_MAX;
+    };
+    for (int i = 0; i < 200; ++i) {
+        float Vmax = uniform(500.0f, 20000.0f);
+        float Amax = uniform(1000.0f, 50000.0f);
+        float Dmax = uniform(1000.0f, 50000.0f);
+        float Jmax = uniform(5000.0f, 500000.0f);
+        float Vi = uniform(-1.2f * Vmax, 1.2f * Vmax);
+        float dX = uniform(-20000.0f, 20000.0f);
+        TEST_CHECK(traj.planSCurve(dX, 0.0f, Vi, Vmax, Amax, Dmax, Jmax));
+        if (!check_profile(traj, dX, 0.0f, Vi, Vmax, Amax, Dmax, Jmax)) {
+            printf("move %d: dX %f Vi %f Vmax %f Amax %f Dmax %f Jmax %f\n", i, dX, Vi, Vmax, Amax, Dmax, Jmax);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool scurve_test() {
+    return long_move_test()
+        && short_move_test()
+        && initial_velocity_test()
+        && reversal_and_overspeed_test()
+        && random_move_test();
+}
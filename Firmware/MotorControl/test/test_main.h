@@ -0,0 +1,35 @@
+#ifndef __TEST_MAIN_H
+#define __TEST_MAIN_H
+
+// Host build of the hardware independent control modules.
+// This header is force-included into every translation unit (see Makefile)
+// and takes the place of odrive_main.h, which pulls in the HAL and FreeRTOS.
+#define __ODRIVE_MAIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+#include <cmath>
+#include <algorithm>
+
+#include <utils.h>
+
+#define CURRENT_MEAS_HZ 8000
+static const float current_meas_period = 1.0f / CURRENT_MEAS_HZ;
+static const int current_meas_hz = CURRENT_MEAS_HZ;
+
+// The protocol definitions are not used on the host
+template<typename ... T> int make_protocol_member_list(T&&...) { return 0; }
+template<typename ... T> int make_protocol_object(T&&...) { return 0; }
+template<typename ... T> int make_protocol_property(T&&...) { return 0; }
+template<typename ... T> int make_protocol_ro_property(T&&...) { return 0; }
+template<typename ... T> int make_protocol_function(T&&...) { return 0; }
+
+class Axis;
+
+#include <input_shaper.hpp>
+#include <repetitive_control.hpp>
+#include <trapTraj.hpp>
+#include <scurveTraj.hpp>
+
+#endif // __TEST_MAIN_H
@@ -0,0 +1,17 @@
+#ifndef __TESTS_HPP
+#define __TESTS_HPP
+
+#include <stdio.h>
+
+#define TEST_CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            return false; \
+        } \
+    } while (0)
+
+bool input_shaper_test();
+bool repetitive_control_test();
+bool scurve_test();
+
+#endif // __TESTS_HPP
@@ -8,6 +8,7 @@ public:
         float accel_limit = 5000.0f; // [count/s^2]
         float decel_limit = 5000.0f; // [count/s^2]
         float A_per_css = 0.0f;      // [A/(count/s^2)]
+        float jerk_limit = 0.0f;     // [count/s^3] use the S-curve planner if non-zero
     };
     
     struct Step_t {
@@ -27,7 +28,8 @@ public:
                 make_protocol_property("vel_limit", &config_.vel_limit),
                 make_protocol_property("accel_limit", &config_.accel_limit),
                 make_protocol_property("decel_limit", &config_.decel_limit),
-                make_protocol_property("A_per_css", &config_.A_per_css)
+                make_protocol_property("A_per_css", &config_.A_per_css),
+                make_protocol_property("jerk_limit", &config_.jerk_limit)
             )
         );
     }
@@ -168,6 +168,13 @@ build{
         'MotorControl/controller.cpp',
         'MotorControl/sensorless_estimator.cpp',
         'MotorControl/trapTraj.cpp',
+        'MotorControl/scurveTraj.cpp',
+        'MotorControl/input_shaper.cpp',
+        'MotorControl/repetitive_control.cpp',
+        'MotorControl/inertia_estimator.cpp',
+        'MotorControl/pvt_fifo.cpp',
+        'MotorControl/motion_table.cpp',
+        'MotorControl/motor_thermal_model.cpp',
         'MotorControl/main.cpp',
         'communication/communication.cpp',
         'communication/ascii_protocol.cpp',
@@ -188,6 +188,7 @@ void ASCII_protocol_process_line(const uint8_t* buffer, size_t len, StreamSink&
         respond(response_channel, use_checksum, "Position: p axis pos vel-ff I-ff");
         respond(response_channel, use_checksum, "Velocity: v axis vel I-ff");
         respond(response_channel, use_checksum, "Current: c axis I");
+        respond(response_channel, use_checksum, "Events (read and clear): e axis");
         respond(response_channel, use_checksum, "");
         respond(response_channel, use_checksum, "Properties start at odrive root, such as axis0.requested_state");
         respond(response_channel, use_checksum, "Read: r property");
@@ -250,6 +251,18 @@ void ASCII_protocol_process_line(const uint8_t* buffer, size_t len, StreamSink&
             }
         }
 
+    } else if (cmd[0] == 'e') { // read and clear events
+        unsigned motor_number;
+        int numscan = sscanf(cmd, "e %u", &motor_number);
+        if (numscan < 1) {
+            respond(response_channel, use_checksum, "invalid command format");
+        } else if (motor_number >= AXIS_COUNT) {
+            respond(response_channel, use_checksum, "invalid motor %u", motor_number);
+        } else {
+            respond(response_channel, use_checksum, "%lu",
+                    (unsigned long)axes[motor_number]->clear_events(UINT32_MAX));
+        }
+
     }else if (cmd[0] == 'u') { // Update axis watchdog. 
         unsigned motor_number;
         int numscan = sscanf(cmd, "u %u", &motor_number);
@@ -266,6 +279,20 @@ void ASCII_protocol_process_line(const uint8_t* buffer, size_t len, StreamSink&
     }
 }
 
+// @brief Sends "e axis events" for each axis that raised events since the
+// last call. The events stay latched until the host clears them with "e axis".
+void ASCII_protocol_notify_events(StreamSink& output) {
+    static uint32_t last_event_count[AXIS_COUNT] = { 0 };
+
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        uint32_t event_count = axes[i]->event_count_;
+        if (event_count != last_event_count[i]) {
+            last_event_count[i] = event_count;
+            respond(output, false, "e %u %lu", (unsigned)i, (unsigned long)axes[i]->events_);
+        }
+    }
+}
+
 void ASCII_protocol_parse_stream(const uint8_t* buffer, size_t len, StreamSink& response_channel) {
     static uint8_t parse_buffer[MAX_LINE_LENGTH];
     static bool read_active = true;
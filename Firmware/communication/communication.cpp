@@ -110,6 +110,10 @@ public:
     float get_oscilloscope_val(uint32_t index) { return oscilloscope[index]; }
     float get_adc_voltage_(uint32_t gpio) { return get_adc_voltage(get_gpio_port_by_pin(gpio), get_gpio_pin_by_pin(gpio)); }
     int32_t test_function(int32_t delta) { static int cnt = 0; return cnt += delta; }
+    bool move_coordinated_helper(float axis0_goal_point, float axis1_goal_point) {
+        const float goal_points[AXIS_COUNT] = { axis0_goal_point, axis1_goal_point };
+        return move_coordinated(goal_points);
+    }
 } static_functions;
 
 // When adding new functions/variables to the protocol, be careful not to
@@ -118,6 +122,7 @@ public:
 static inline auto make_obj_tree() {
     return make_protocol_member_list(
         make_protocol_ro_property("vbus_voltage", &vbus_voltage),
+        make_protocol_ro_property("vbus_voltage_instant", &vbus_voltage_instant),
         make_protocol_ro_property("serial_number", &serial_number),
         make_protocol_ro_property("hw_version_major", &hw_version_major),
         make_protocol_ro_property("hw_version_minor", &hw_version_minor),
@@ -156,8 +161,12 @@ static inline auto make_obj_tree() {
             make_protocol_property("enable_uart", &board_config.enable_uart),
             make_protocol_property("enable_i2c_instead_of_can" , &board_config.enable_i2c_instead_of_can), // requires a reboot
             make_protocol_property("enable_ascii_protocol_on_usb", &board_config.enable_ascii_protocol_on_usb),
+            make_protocol_property("enable_uart_event_notifications", &board_config.enable_uart_event_notifications),
             make_protocol_property("dc_bus_undervoltage_trip_level", &board_config.dc_bus_undervoltage_trip_level),
             make_protocol_property("dc_bus_overvoltage_trip_level", &board_config.dc_bus_overvoltage_trip_level),
+            make_protocol_property("dc_bus_voltage_filter_tau", &board_config.dc_bus_voltage_filter_tau),
+            make_protocol_property("enable_simultaneous_adc", &board_config.enable_simultaneous_adc),
+            make_protocol_property("current_meas_oversampling", &board_config.current_meas_oversampling),
 #if HW_VERSION_MAJOR == 3 && HW_VERSION_MINOR >= 3
             make_protocol_object("gpio1_pwm_mapping", make_protocol_definitions(board_config.pwm_mappings[0])),
             make_protocol_object("gpio2_pwm_mapping", make_protocol_definitions(board_config.pwm_mappings[1])),
@@ -175,6 +184,7 @@ static inline auto make_obj_tree() {
         make_protocol_function("test_function", static_functions, &StaticFunctions::test_function, "delta"),
         make_protocol_function("get_oscilloscope_val", static_functions, &StaticFunctions::get_oscilloscope_val, "index"),
         make_protocol_function("get_adc_voltage", static_functions, &StaticFunctions::get_adc_voltage_, "gpio"),
+        make_protocol_function("move_coordinated", static_functions, &StaticFunctions::move_coordinated_helper, "axis0_goal_point", "axis1_goal_point"),
         make_protocol_function("save_configuration", static_functions, &StaticFunctions::save_configuration_helper),
         make_protocol_function("erase_configuration", static_functions, &StaticFunctions::erase_configuration_helper),
         make_protocol_function("reboot", static_functions, &StaticFunctions::NVIC_SystemReset_helper),
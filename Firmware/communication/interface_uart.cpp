@@ -10,6 +10,8 @@
 #include <cmsis_os.h>
 #include <freertos_vars.h>
 
+#include <odrive_main.h>
+
 #define UART_TX_BUFFER_SIZE 64
 #define UART_RX_BUFFER_SIZE 64
 
@@ -86,6 +88,9 @@ static void uart_server_thread(void * ctx) {
             dma_last_rcv_idx = new_rcv_idx;
         }
 
+        if (board_config.enable_uart_event_notifications)
+            ASCII_protocol_notify_events(uart4_stream_output);
+
         osDelay(1);
     };
 }
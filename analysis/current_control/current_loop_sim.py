@@ -0,0 +1,145 @@
+"""
+Host simulation of the FOC current loop in Motor::FOC_current.
+
+The motor is modelled in the rotor (dq) frame at a constant electrical speed:
+  L dId/dt = Vd - R Id + omega L Iq
+  L dIq/dt = Vq - R Iq - omega L Id - omega flux_linkage
+The controller runs once per current measurement period and its voltage is
+applied during the next period, like on the ODrive. The gains are the ones
+set by Motor::update_current_controller_gains.
+
+Run this file to compare the tracking of a step in Iq over speed, with and
+without the dq decoupling and back-EMF feed-forward, and the current that
+can be reached above base speed with and without field weakening.
+"""
+
+import math
+
+# ODrive v3 timing, see Board/v3/Inc/main.h
+current_meas_period = 2 * 3500 * (2 + 1) / 168e6  # [s]
+sqrt3_by_2 = math.sqrt(3) / 2
+
+class Motor:
+    def __init__(self, R=0.05, L=20e-6, flux_linkage=2.9e-3):
+        self.R = R  # [Ohm]
+        self.L = L  # [H]
+        self.flux_linkage = flux_linkage  # [V/(rad/s)]
+        self.Id = 0.0
+        self.Iq = 0.0
+
+    def step(self, Vd, Vq, omega, dt, substeps=20):
+        h = dt / substeps
+        for _ in range(substeps):
+            dId = (Vd - self.R * self.Id + omega * self.L * self.Iq) / self.L
+            dIq = (Vq - self.R * self.Iq - omega * self.L * self.Id - omega * self.flux_linkage) / self.L
+            self.Id += h * dId
+            self.Iq += h * dIq
+
+class CurrentController:
+    def __init__(self, motor, bandwidth=1000.0, vbus=24.0,
+                 decoupling=False, back_emf_ff=False, max_modulation=0.80 * sqrt3_by_2,
+                 field_weakening=False, fw_max_current=10.0, fw_modulation=0.95, fw_gain=10000.0):
+        self.p_gain = bandwidth * motor.L
+        self.i_gain = (motor.R / motor.L) * self.p_gain
+        self.L = motor.L
+        self.flux_linkage = motor.flux_linkage
+        self.vbus = vbus
+        self.decoupling = decoupling
+        self.back_emf_ff = back_emf_ff
+        self.max_modulation = max_modulation
+        self.field_weakening = field_weakening
+        self.fw_max_current = fw_max_current
+        self.fw_modulation = fw_modulation
+        self.fw_gain = fw_gain
+        self.integral_d = 0.0
+        self.integral_q = 0.0
+        self.mod_demand_ratio = 0.0
+        self.Id_setpoint = 0.0
+
+    def update_field_weakening(self):
+        if not self.field_weakening:
+            return 0.0
+        mod_excess = self.mod_demand_ratio - self.fw_modulation
+        Id = self.Id_setpoint - self.fw_gain * current_meas_period * mod_excess
+        self.Id_setpoint = max(-self.fw_max_current, min(Id, 0.0))
+        return self.Id_setpoint
+
+    def update(self, Id_des, Iq_des, Id, Iq, omega):
+        Vd_ff = 0.0
+        Vq_ff = 0.0
+        if self.decoupling:
+            Vd_ff -= omega * self.L * Iq
+            Vq_ff += omega * self.L * Id
+        if self.back_emf_ff:
+            Vq_ff += omega * self.flux_linkage
+
+        Ierr_d = Id_des - Id
+        Ierr_q = Iq_des - Iq
+        Vd = Vd_ff + self.integral_d + Ierr_d * self.p_gain
+        Vq = Vq_ff + self.integral_q + Ierr_q * self.p_gain
+
+        mod_to_V = (2.0 / 3.0) * self.vbus
+        mod_d = Vd / mod_to_V
+        mod_q = Vq / mod_to_V
+        mod = math.hypot(mod_d, mod_q)
+        self.mod_demand_ratio = mod / self.max_modulation
+        if mod > self.max_modulation:
+            mod_d *= self.max_modulation / mod
+            mod_q *= self.max_modulation / mod
+            self.integral_d *= 0.99
+            self.integral_q *= 0.99
+        else:
+            self.integral_d += Ierr_d * self.i_gain * current_meas_period
+            self.integral_q += Ierr_q * self.i_gain * current_meas_period
+        return mod_d * mod_to_V, mod_q * mod_to_V
+
+def simulate_step(omega, Iq_step=10.0, settle_time=0.05, step_time=0.01, **controller_args):
+    """
+    Settles at Iq = 0 and then steps to Iq_step.
+    Returns the RMS error of Iq and the peak |Id| after the step.
+    """
+    motor = Motor()
+    ctrl = CurrentController(motor, **controller_args)
+    V = (0.0, 0.0)
+    n_settle = int(settle_time / current_meas_period)
+    n_step = int(step_time / current_meas_period)
+    sq_err = 0.0
+    peak_Id = 0.0
+    for i in range(n_settle + n_step):
+        Iq_des = Iq_step if i >= n_settle else 0.0
+        V_next = ctrl.update(0.0, Iq_des, motor.Id, motor.Iq, omega)
+        motor.step(V[0], V[1], omega, current_meas_period)
+        V = V_next
+        if i >= n_settle:
+            sq_err += (Iq_des - motor.Iq) ** 2
+            peak_Id = max(peak_Id, abs(motor.Id))
+    return math.sqrt(sq_err / n_step), peak_Id
+
+def simulate_field_weakening(omega, Iq_des=10.0, sim_time=0.3, **controller_args):
+    """
+    Runs at a fixed Iq setpoint and returns the final Id and Iq.
+    """
+    motor = Motor()
+    ctrl = CurrentController(motor, **controller_args)
+    V = (0.0, 0.0)
+    for i in range(int(sim_time / current_meas_period)):
+        Id_des = ctrl.update_field_weakening()
+        V_next = ctrl.update(Id_des, Iq_des, motor.Id, motor.Iq, omega)
+        motor.step(V[0], V[1], omega, current_meas_period)
+        V = V_next
+    return motor.Id, motor.Iq
+
+if __name__ == '__main__':
+    print("omega [rad/s] | Iq RMS error [A]  PI only / decoupled+BEMF ff | peak |Id| [A]  PI only / decoupled+BEMF ff")
+    for omega in [0, 500, 1000, 1500, 2000, 2500]:
+        err_pi, id_pi = simulate_step(omega)
+        err_ff, id_ff = simulate_step(omega, decoupling=True, back_emf_ff=True)
+        print("{:13.0f} | {:8.3f} / {:8.3f} | {:8.3f} / {:8.3f}".format(omega, err_pi, err_ff, id_pi, id_ff))
+
+    print("")
+    print("omega [rad/s] | Iq at 10A setpoint [A]  no field weakening / field weakening | Id [A]")
+    for omega in [3000, 3500, 4000]:
+        _, Iq_nofw = simulate_field_weakening(omega, decoupling=True, back_emf_ff=True)
+        Id_fw, Iq_fw = simulate_field_weakening(omega, decoupling=True, back_emf_ff=True,
+                                                field_weakening=True, fw_max_current=30.0)
+        print("{:13.0f} | {:8.3f} / {:8.3f} | {:8.3f}".format(omega, Iq_nofw, Iq_fw, Id_fw))
@@ -0,0 +1,146 @@
+"""
+Host simulation of the flux linkage calibration in Motor::measure_flux_linkage.
+
+The motor is modelled in the stationary frame together with its rotor:
+  L di/dt = v - R i - omega_r flux_linkage (-sin theta_r, cos theta_r)
+  J domega_m/dt = 3/2 pole_pairs flux_linkage Iq_rotor - b omega_m - load_torque
+The current controller runs in the frame of the open loop current vector,
+once per current measurement period, and its voltage is applied during the
+next period. The calibration spins the current vector through the same
+speed profile as the firmware and fits the back-EMF magnitude over speed.
+
+Run this file to compare the identified flux linkage with the one of the
+simulated motor, with exact and with wrong resistance and inductance
+estimates, and with a load on the rotor.
+"""
+
+import math
+from current_loop_sim import current_meas_period, sqrt3_by_2
+
+class RotorMotor:
+    def __init__(self, R=0.05, L=20e-6, flux_linkage=2.9e-3, pole_pairs=7,
+                 inertia=2e-5, damping=1e-5, load_torque=0.0):
+        self.R = R  # [Ohm]
+        self.L = L  # [H]
+        self.flux_linkage = flux_linkage  # [V/(rad/s)]
+        self.pole_pairs = pole_pairs
+        self.inertia = inertia  # [kg m^2]
+        self.damping = damping  # [Nm/(rad/s)]
+        self.load_torque = load_torque  # [Nm]
+        self.I_alpha = 0.0
+        self.I_beta = 0.0
+        self.theta = 0.0  # [rad] electrical rotor angle
+        self.omega = 0.0  # [rad/s] electrical speed
+
+    def step(self, V_alpha, V_beta, dt, substeps=10):
+        h = dt / substeps
+        for _ in range(substeps):
+            c = math.cos(self.theta)
+            s = math.sin(self.theta)
+            e_alpha = -self.omega * self.flux_linkage * s
+            e_beta = self.omega * self.flux_linkage * c
+            self.I_alpha += h * (V_alpha - self.R * self.I_alpha - e_alpha) / self.L
+            self.I_beta += h * (V_beta - self.R * self.I_beta - e_beta) / self.L
+            Iq = c * self.I_beta - s * self.I_alpha
+            torque = 1.5 * self.pole_pairs * self.flux_linkage * Iq
+            omega_m = self.omega / self.pole_pairs
+            friction = self.damping * omega_m + math.copysign(self.load_torque, omega_m) if omega_m else 0.0
+            omega_m += h * (torque - friction) / self.inertia
+            self.omega = omega_m * self.pole_pairs
+            self.theta += h * self.omega
+
+def measure_flux_linkage(motor, R_est, L_est, current=10.0, calib_vel=200.0, calib_accel=100.0,
+                         num_points=4, align_time=0.4, settle_time=0.2, measure_time=0.3,
+                         bandwidth=1000.0, vbus=24.0):
+    """
+    Runs the calibration sequence on the simulated motor.
+    Returns the identified flux linkage, or None if fewer than two speeds
+    could be measured.
+    """
+    p_gain = bandwidth * L_est
+    i_gain = (R_est / L_est) * p_gain
+    max_V = 0.80 * sqrt3_by_2 * (2.0 / 3.0) * vbus
+    state = {'integral_d': 0.0, 'integral_q': 0.0, 'V': (0.0, 0.0)}
+
+    def control(I_des, phase, vel):
+        # Measure, then compute the voltage for the next period
+        c = math.cos(phase)
+        s = math.sin(phase)
+        Id = c * motor.I_alpha + s * motor.I_beta
+        Iq = c * motor.I_beta - s * motor.I_alpha
+        Vd = state['integral_d'] + (0.0 - Id) * p_gain
+        Vq = state['integral_q'] + (I_des - Iq) * p_gain
+        V = math.hypot(Vd, Vq)
+        saturated = V > max_V
+        if saturated:
+            Vd *= max_V / V
+            Vq *= max_V / V
+        else:
+            state['integral_d'] += (0.0 - Id) * i_gain * current_meas_period
+            state['integral_q'] += (I_des - Iq) * i_gain * current_meas_period
+        pwm_phase = phase + 1.5 * current_meas_period * vel
+        c_p = math.cos(pwm_phase)
+        s_p = math.sin(pwm_phase)
+        V_next = (c_p * Vd - s_p * Vq, c_p * Vq + s_p * Vd)
+        motor.step(state['V'][0], state['V'][1], current_meas_period)
+        state['V'] = V_next
+        return Id, Iq, Vd, Vq, saturated
+
+    # Pull the rotor into alignment
+    n_align = int(align_time / current_meas_period)
+    for i in range(n_align):
+        control(current * min((i + 1) / n_align, 1.0), 0.0, 0.0)
+
+    settle_cycles = int(settle_time / current_meas_period)
+    measure_cycles = int(measure_time / current_meas_period)
+    max_vel_step = calib_accel * current_meas_period
+    phase = 0.0
+    vel = 0.0
+    omegas = []
+    emfs = []
+    for k in range(num_points):
+        target_vel = calib_vel * (k + 1) / num_points
+        e_d_sum = 0.0
+        e_q_sum = 0.0
+        i = 0
+        saturated = False
+        while i < settle_cycles + measure_cycles and not saturated:
+            vel_error = target_vel - vel
+            vel = target_vel if abs(vel_error) <= max_vel_step else vel + math.copysign(max_vel_step, vel_error)
+            phase += vel * current_meas_period
+            Id, Iq, Vd, Vq, saturated = control(current, phase, vel)
+            if vel != target_vel:
+                continue
+            i += 1
+            if i > settle_cycles:
+                e_d_sum += Vd - R_est * Id + vel * L_est * Iq
+                e_q_sum += Vq - R_est * Iq - vel * L_est * Id
+        if saturated:
+            break
+        omegas.append(target_vel)
+        emfs.append(math.hypot(e_d_sum, e_q_sum) / measure_cycles)
+
+    if len(omegas) < 2:
+        return None
+    omega_mean = sum(omegas) / len(omegas)
+    emf_mean = sum(emfs) / len(emfs)
+    cov = sum((w - omega_mean) * (e - emf_mean) for w, e in zip(omegas, emfs))
+    var = sum((w - omega_mean) ** 2 for w in omegas)
+    return cov / var
+
+if __name__ == '__main__':
+    print("case                     | flux linkage [mWb] true / identified | error [%]")
+    cases = [
+        ("exact R and L", {}, 1.0, 1.0),
+        ("R +20%", {}, 1.2, 1.0),
+        ("R -20%", {}, 0.8, 1.0),
+        ("L +50%", {}, 1.0, 1.5),
+        ("load 0.02Nm", {'load_torque': 0.02}, 1.0, 1.0),
+        ("flux linkage 8.0mWb", {'flux_linkage': 8.0e-3}, 1.0, 1.0),
+    ]
+    for name, motor_args, R_factor, L_factor in cases:
+        motor = RotorMotor(**motor_args)
+        flux_linkage = measure_flux_linkage(motor, motor.R * R_factor, motor.L * L_factor)
+        print("{:24s} | {:8.3f} / {:8.3f} | {:6.2f}".format(
+            name, motor.flux_linkage * 1e3, flux_linkage * 1e3,
+            100.0 * (flux_linkage - motor.flux_linkage) / motor.flux_linkage))
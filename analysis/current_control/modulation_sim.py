@@ -0,0 +1,116 @@
+"""
+Host model of the voltage modulator in Motor::FOC_current.
+
+Modulation is normalized like in the firmware: 1.0 is a hexagon vertex,
+i.e. a phase switched fully between the bus rails (2/3 vbus in the alpha
+beta frame). The largest circle inside the hexagon, the limit of linear
+space vector modulation, has a radius of sqrt(3)/2 and six-step operation
+has a fundamental of 3/pi.
+
+Overmodulation follows the usual two regions:
+  I:  the reference is scaled up and clipped to the hexagon, so the
+      fundamental grows up to that of following the hexagon boundary.
+  II: the vector is additionally held at the nearest vertex for a hold angle
+      that grows up to pi/6, i.e. six-step.
+The compensation from the requested fundamental to the scale and the hold
+angle is tabulated; run this file to print the tables used in motor.cpp and
+the fundamental and harmonic distortion of each modulation mode.
+"""
+
+import math
+
+sqrt3_by_2 = math.sqrt(3) / 2
+six_step_fundamental = 3 / math.pi
+table_size = 9
+
+def hexagon_radius(theta):
+    phi = (theta % (math.pi / 3)) - math.pi / 6
+    return sqrt3_by_2 / math.cos(phi)
+
+def region_1(scale, theta):
+    m = min(scale, hexagon_radius(theta))
+    return m * math.cos(theta), m * math.sin(theta)
+
+def region_2(hold_angle, theta):
+    vertex = round(theta / (math.pi / 3)) * (math.pi / 3)
+    d = theta - vertex
+    if abs(d) <= hold_angle:
+        return math.cos(vertex), math.sin(vertex)
+    d = math.copysign((abs(d) - hold_angle) / (math.pi / 6 - hold_angle) * (math.pi / 6), d)
+    m = sqrt3_by_2 / math.cos(math.pi / 6 - abs(d))
+    return m * math.cos(vertex + d), m * math.sin(vertex + d)
+
+def fundamental(modulator, N=3600):
+    s = 0.0
+    for i in range(N):
+        theta = 2 * math.pi * i / N
+        alpha, beta = modulator(theta)
+        s += alpha * math.cos(theta) + beta * math.sin(theta)
+    return s / N
+
+def harmonic_distortion(modulator, N=3600):
+    """ THD of the phase A voltage (the alpha component) """
+    f = fundamental(modulator, N)
+    total = 0.0
+    for i in range(N):
+        theta = 2 * math.pi * i / N
+        alpha, _ = modulator(theta)
+        total += alpha * alpha
+    rms_total = math.sqrt(total / N)
+    rms_fundamental = f / math.sqrt(2)
+    return math.sqrt(max(rms_total ** 2 - rms_fundamental ** 2, 0.0)) / rms_fundamental
+
+def invert(fn, target, lo, hi):
+    for _ in range(50):
+        mid = 0.5 * (lo + hi)
+        if fn(mid) < target:
+            lo = mid
+        else:
+            hi = mid
+    return 0.5 * (lo + hi)
+
+def make_tables():
+    hexagon_fundamental = fundamental(lambda th: region_1(1.0, th))
+    scales = []
+    for i in range(table_size):
+        m = sqrt3_by_2 + (hexagon_fundamental - sqrt3_by_2) * i / (table_size - 1)
+        scales.append(invert(lambda s: fundamental(lambda th: region_1(s, th)), m, sqrt3_by_2, 1.0))
+    hold_angles = []
+    for i in range(table_size):
+        m = hexagon_fundamental + (six_step_fundamental - hexagon_fundamental) * i / (table_size - 1)
+        hold_angles.append(invert(lambda a: fundamental(lambda th: region_2(a, th)), m, 0.0, math.pi / 6 - 1e-9))
+    return hexagon_fundamental, scales, hold_angles
+
+def overmodulator(m, hexagon_fundamental, scales, hold_angles):
+    def interp(table, x):
+        x = max(0.0, min(x, 1.0)) * (table_size - 1)
+        i = min(int(x), table_size - 2)
+        return table[i] + (x - i) * (table[i + 1] - table[i])
+    if m <= sqrt3_by_2:
+        return lambda th: (m * math.cos(th), m * math.sin(th))
+    if m <= hexagon_fundamental:
+        s = interp(scales, (m - sqrt3_by_2) / (hexagon_fundamental - sqrt3_by_2))
+        return lambda th: region_1(s, th)
+    a = interp(hold_angles, (m - hexagon_fundamental) / (six_step_fundamental - hexagon_fundamental))
+    return lambda th: region_2(a, th)
+
+if __name__ == '__main__':
+    hexagon_fundamental, scales, hold_angles = make_tables()
+    print("hexagon fundamental: {:.6f}".format(hexagon_fundamental))
+    print("region I scale table:   {" + ", ".join("{:.5f}f".format(s) for s in scales) + "}")
+    print("region II hold angles:  {" + ", ".join("{:.5f}f".format(a) for a in hold_angles) + "}")
+    print("")
+    print("mode                  | max fundamental | modulation index | THD at max")
+    modes = [
+        ("linear, limited (80%)", 0.80 * sqrt3_by_2),
+        ("linear", sqrt3_by_2),
+    ]
+    for name, m in modes:
+        mod = lambda th, m=m: (m * math.cos(th), m * math.sin(th))
+        print("{:21s} | {:15.4f} | {:16.3f} | {:10.3f}".format(name, fundamental(mod), fundamental(mod) / six_step_fundamental, harmonic_distortion(mod)))
+    print("")
+    print("overmodulation: requested -> achieved fundamental, THD")
+    for i in range(11):
+        m = sqrt3_by_2 + (six_step_fundamental - sqrt3_by_2) * i / 10
+        mod = overmodulator(m, hexagon_fundamental, scales, hold_angles)
+        print("{:8.4f} -> {:8.4f}  THD {:6.3f}".format(m, fundamental(mod), harmonic_distortion(mod)))
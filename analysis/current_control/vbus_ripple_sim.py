@@ -0,0 +1,91 @@
+"""
+Host simulation of the current loop on a rippling DC bus.
+
+The supply reaches the DC link capacitor through the inductance and
+resistance of the supply leads, and carries some ripple of its own:
+  L_lead dI_lead/dt = V_supply(t) - R_lead I_lead - vbus
+  C dvbus/dt = I_lead - I_bus
+The inverter draws I_bus = 3/2 (Vd Id + Vq Iq) / vbus. The modulation that
+the controller computes is applied during the next measurement period, and
+the phase voltage is the modulation times the bus voltage at each instant.
+
+The controller converts its voltage to modulation either with the filtered
+bus voltage (motor.config.enable_vbus_compensation = False) or with the bus
+voltage sampled together with the currents (True), and the ripple of Iq
+around its setpoint is compared.
+"""
+
+import math
+from current_loop_sim import Motor, CurrentController, current_meas_period
+
+class Bus:
+    def __init__(self, V_supply=24.0, ripple=1.5, ripple_freq=300.0,
+                 L_lead=5e-6, R_lead=0.05, C=1000e-6):
+        self.V_supply = V_supply
+        self.ripple = ripple  # [V] amplitude of the supply ripple
+        self.ripple_freq = ripple_freq  # [Hz]
+        self.L_lead = L_lead  # [H]
+        self.R_lead = R_lead  # [Ohm]
+        self.C = C  # [F]
+        self.I_lead = 0.0
+        self.vbus = V_supply
+
+    def step(self, I_bus, t, h):
+        V = self.V_supply + self.ripple * math.sin(2 * math.pi * self.ripple_freq * t)
+        self.I_lead += h * (V - self.R_lead * self.I_lead - self.vbus) / self.L_lead
+        self.vbus += h * (self.I_lead - I_bus) / self.C
+
+def simulate_ripple(omega, compensation, Iq_des=10.0, filter_tau=0.002,
+                    settle_time=0.05, sim_time=0.05, substeps=20, **bus_args):
+    """
+    Runs at a fixed Iq setpoint and returns the RMS and the peak to peak
+    ripple of Iq after settling, and the peak to peak ripple of vbus.
+    """
+    motor = Motor()
+    bus = Bus(**bus_args)
+    ctrl = CurrentController(motor, decoupling=True, back_emf_ff=True)
+    h = current_meas_period / substeps
+    vbus_filtered = bus.vbus
+    mod = (0.0, 0.0)
+    n_settle = int(settle_time / current_meas_period)
+    n_sim = int(sim_time / current_meas_period)
+    sq_err = 0.0
+    Iq_min = Iq_max = Iq_des
+    vbus_min = vbus_max = bus.vbus
+    t = 0.0
+    for i in range(n_settle + n_sim):
+        # Sample, then compute the modulation for the next period
+        vbus_sample = bus.vbus
+        vbus_filtered += (vbus_sample - vbus_filtered) * min(current_meas_period / filter_tau, 1.0)
+        ctrl.vbus = vbus_sample if compensation else vbus_filtered
+        mod_to_V = (2.0 / 3.0) * ctrl.vbus
+        Vd, Vq = ctrl.update(0.0, Iq_des, motor.Id, motor.Iq, omega)
+        mod_next = (Vd / mod_to_V, Vq / mod_to_V)
+
+        # Apply the previous modulation during this period
+        for _ in range(substeps):
+            Vd = mod[0] * (2.0 / 3.0) * bus.vbus
+            Vq = mod[1] * (2.0 / 3.0) * bus.vbus
+            I_bus = 1.5 * (Vd * motor.Id + Vq * motor.Iq) / bus.vbus
+            motor.step(Vd, Vq, omega, h, substeps=1)
+            bus.step(I_bus, t, h)
+            t += h
+            if i >= n_settle:
+                vbus_min = min(vbus_min, bus.vbus)
+                vbus_max = max(vbus_max, bus.vbus)
+        mod = mod_next
+
+        if i >= n_settle:
+            sq_err += (Iq_des - motor.Iq) ** 2
+            Iq_min = min(Iq_min, motor.Iq)
+            Iq_max = max(Iq_max, motor.Iq)
+    return math.sqrt(sq_err / n_sim), Iq_max - Iq_min, vbus_max - vbus_min
+
+if __name__ == '__main__':
+    print("ripple [Hz] omega [rad/s] | vbus p-p [V] | Iq RMS error [A]  filtered / compensated | Iq p-p [A]  filtered / compensated")
+    for ripple_freq in [100, 300, 1000]:
+        for omega in [0, 1500]:
+            rms_f, pp_f, vpp = simulate_ripple(omega, False, ripple_freq=ripple_freq)
+            rms_c, pp_c, _ = simulate_ripple(omega, True, ripple_freq=ripple_freq)
+            print("{:11.0f} {:13.0f} | {:12.2f} | {:8.3f} / {:8.3f} | {:8.3f} / {:8.3f}".format(
+                ripple_freq, omega, vpp, rms_f, rms_c, pp_f, pp_c))
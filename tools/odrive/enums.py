@@ -12,6 +12,15 @@ AXIS_STATE_ENCODER_OFFSET_CALIBRATION = 7
 AXIS_STATE_CLOSED_LOOP_CONTROL = 8
 AXIS_STATE_LOCKIN_SPIN = 9
 AXIS_STATE_ENCODER_DIR_FIND = 10
+AXIS_STATE_HOMING = 11
+AXIS_STATE_FLUX_LINKAGE_CALIBRATION = 12
+
+EVENT_NONE = 0x00
+EVENT_IN_POSITION = 0x01
+EVENT_TRAJECTORY_DONE = 0x02
+EVENT_ERROR = 0x04
+EVENT_PVT_UNDERRUN = 0x08
+EVENT_PVT_LOW_WATERMARK = 0x10
 
 class errors:
     class axis:
@@ -28,6 +37,7 @@ class errors:
         ERROR_CONTROLLER_FAILED = 0x200
         ERROR_POS_CTRL_DURING_SENSORLESS = 0x400
         ERROR_WATCHDOG_TIMER_EXPIRED = 0x800
+        ERROR_HOMING_SWITCH_NOT_FOUND = 0x1000
 
     class motor:
         ERROR_NONE = 0
@@ -55,16 +65,35 @@ class errors:
     class controller:
         ERROR_NONE = 0
         ERROR_OVERSPEED = 0x01
+        ERROR_EXCESSIVE_LOAD_TORQUE = 0x02
+        ERROR_INVALID_GEARING_MASTER = 0x04
+        ERROR_INVALID_LOAD_MODEL = 0x08
+        ERROR_INVALID_INPUT_SHAPER = 0x10
 
 MOTOR_TYPE_HIGH_CURRENT = 0
 #MOTOR_TYPE_LOW_CURRENT = 1
 MOTOR_TYPE_GIMBAL = 2
 
+MODULATION_MODE_LINEAR_LIMITED = 0
+MODULATION_MODE_LINEAR = 1
+MODULATION_MODE_OVERMODULATION = 2
+
 CTRL_MODE_VOLTAGE_CONTROL = 0
 CTRL_MODE_CURRENT_CONTROL = 1
 CTRL_MODE_VELOCITY_CONTROL = 2
 CTRL_MODE_POSITION_CONTROL = 3
 CTRL_MODE_TRAJECTORY_CONTROL = 4
+CTRL_MODE_GEARING = 5
+CTRL_MODE_PVT = 6
+CTRL_MODE_MOTION_TABLE = 7
+
+INPUT_SHAPER_TYPE_NONE = 0
+INPUT_SHAPER_TYPE_ZV = 1
+INPUT_SHAPER_TYPE_ZVD = 2
+INPUT_SHAPER_TYPE_EI = 3
+
+REPETITIVE_CONTROL_INDEX_POSITION = 0
+REPETITIVE_CONTROL_INDEX_TIME = 1
 
 ENCODER_MODE_INCREMENTAL = 0
 ENCODER_MODE_HALL = 1
@@ -149,6 +149,30 @@ def show_oscilloscope(odrv):
     plt.plot(values)
     plt.show()
 
+def upload_motion_table(axis, points, sample_time):
+    """
+    Uploads a precomputed motion profile to axis.controller.motion_table.
+    points is a sequence of (pos, vel, current) tuples [counts, counts/s, A]
+    sampled every sample_time seconds, e.g. x, v and u of
+    analysis/numeric_path_opt.
+    The table is allocated at startup, so a table that is too small has to be
+    resized with config.size, saved and the ODrive rebooted first.
+    """
+    table = axis.controller.motion_table
+    block_size = 4 # points per set_points call
+    if len(points) > table.config.size:
+        raise Exception("the motion table holds {} points, set config.size to at least {}, "
+                        "save the configuration and reboot".format(table.config.size, len(points)))
+    table.config.sample_time = sample_time
+    table.clear()
+    for i in range(0, len(points), block_size):
+        block = [tuple(p) for p in points[i:i + block_size]]
+        count = len(block)
+        block += [(0.0, 0.0, 0.0)] * (block_size - count)
+        args = [value for point in block for value in point]
+        if not table.set_points(i, count, *args):
+            raise Exception("failed to write points {} to {} of the motion table".format(i, i + count - 1))
+
 def rate_test(device):
     """
     Tests how many integers per second can be transmitted